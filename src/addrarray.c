@@ -0,0 +1,83 @@
+#include "addrarray.h"
+
+/**
+ * @brief   Allocate an address array
+ * @param   bits    number of bits of addresses (16 or 24)
+ * @return  pointer to newly allocated address array, or NULL on error
+ **/
+
+addrarray_t *addrarray_alloc(unsigned int bits)
+{
+    addrarray_t *p_array;
+
+    p_array = (addrarray_t *)malloc(sizeof(addrarray_t));
+    if (p_array != NULL)
+    {
+        p_array->size = 1ULL << bits;
+        p_array->p_votes = (uint32_t *)calloc(p_array->size, sizeof(uint32_t));
+        if (p_array->p_votes == NULL)
+        {
+            free(p_array);
+            return NULL;
+        }
+    }
+
+    return p_array;
+}
+
+
+/**
+ * @brief   Free an address array
+ * @param   p_array     pointer to the address array to free
+ **/
+
+void addrarray_free(addrarray_t *p_array)
+{
+    if (p_array != NULL)
+    {
+        free(p_array->p_votes);
+        free(p_array);
+    }
+}
+
+
+/**
+ * @brief   Get the highest number of votes of an address array
+ * @param   p_array     pointer to an address array
+ * @return  highest number of votes
+ **/
+
+int addrarray_max_vote(addrarray_t *p_array)
+{
+    uint32_t max_vote = 0;
+    uint64_t i;
+
+    for (i=0; i<p_array->size; i++)
+    {
+        if (p_array->p_votes[i] > max_vote)
+            max_vote = p_array->p_votes[i];
+    }
+
+    return (int)max_vote;
+}
+
+
+/**
+ * @brief   Call a callback function for each address having at least one vote
+ *
+ * Addresses are browsed in ascending order, as with addrtree_browse().
+ *
+ * @param   p_array     pointer to an address array
+ * @param   p_callback  callback function
+ **/
+
+void addrarray_browse(addrarray_t *p_array, FAddressTreeCallback p_callback)
+{
+    uint64_t i;
+
+    for (i=0; i<p_array->size; i++)
+    {
+        if (p_array->p_votes[i] > 0)
+            p_callback(i, (int)p_array->p_votes[i]);
+    }
+}
@@ -0,0 +1,38 @@
+/**
+ * Memory Address Array
+ *
+ * Memory Address Array is a flat array of votes indexed by address, used instead
+ * of a memory address tree when the whole address space is small enough: with
+ * 16-bit and 24-bit architectures, candidate addresses fit in an array of 64K
+ * or 16M counters and registering an address costs a single increment, instead
+ * of walking (and allocating) up to 8 tree nodes.
+ **/
+
+#pragma once
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "addrtree.h"
+
+typedef struct {
+    uint32_t *p_votes;
+    uint64_t size;
+} addrarray_t;
+
+addrarray_t *addrarray_alloc(unsigned int bits);
+void addrarray_free(addrarray_t *p_array);
+int addrarray_max_vote(addrarray_t *p_array);
+void addrarray_browse(addrarray_t *p_array, FAddressTreeCallback p_callback);
+
+
+/**
+ * @brief   Register a new address into an address array
+ * @param   p_array         pointer to an address array
+ * @param   u64_address     address to register (must be lower than the array size)
+ **/
+
+static inline void addrarray_register_address(addrarray_t *p_array, uint64_t u64_address)
+{
+    p_array->p_votes[u64_address]++;
+}
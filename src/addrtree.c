@@ -241,9 +241,9 @@ int addrtree_count_nodes(addrtree_node_t *p_node)
  * @return  memory size
  **/
 
-unsigned int addrtree_get_memsize(addrtree_node_t *p_node)
+uint64_t addrtree_get_memsize(addrtree_node_t *p_node)
 {
-    unsigned int nb_nodes = p_node->nb_nodes;/*addrtree_count_nodes(p_node)+1;*/
+    uint64_t nb_nodes = p_node->nb_nodes;/*addrtree_count_nodes(p_node)+1;*/
     return nb_nodes*sizeof(addrtree_node_t);
 }
 
@@ -46,6 +46,6 @@ void addrtree_node_free(addrtree_node_t *p_node);
 int addrtree_max_vote(addrtree_node_t *p_node);
 int addrtree_sum_vote(addrtree_node_t *p_node);
 void addrtree_filter(addrtree_node_t *p_node, int votes_threshold);
-unsigned int addrtree_get_memsize(addrtree_node_t *p_node);
+uint64_t addrtree_get_memsize(addrtree_node_t *p_node);
 int addrtree_count_nodes(addrtree_node_t *p_node);
 double addrtree_avg_vote(addrtree_node_t *p_node);
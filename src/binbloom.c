@@ -3,15 +3,22 @@
 #include <stdint.h>
 #include <math.h>
 #include <getopt.h>
-#include <ctype.h>
 #include <pthread.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 /* Include our libs. */
+#include "addrarray.h"
 #include "addrtree.h"
+#include "bitmap.h"
+#include "diag.h"
 #include "poi.h"
 #include "helpers.h"
 #include "common.h"
 #include "memregion.h"
+#include "msbhist.h"
+#include "ptrcache.h"
 #include "log.h"
 #include "functions.h"
 
@@ -36,6 +43,73 @@ typedef struct {
     int has_valid_array;
 } score_entry_t;
 
+/* Array of structures found by autocorrelation, before signature extraction. */
+typedef struct {
+    uint64_t offset;
+    int64_t count;
+    int nb_members;
+} struct_array_t;
+
+/* Structure size candidate (pointer type and lag), used by autocorrelation. */
+typedef struct {
+    poi_type_t type;
+    int lag;
+    uint64_t score;
+} struct_period_t;
+
+/* Structure of parameters used in parallel diagnostic database search. */
+typedef struct {
+    poi_t **pp_structs;
+    diag_heap_t *p_heaps;
+    uint64_t start;
+    uint64_t count;
+} diag_params_t;
+
+/* MSB histograms of LE and BE values of a given width, counted up to `limit`. */
+typedef struct {
+    msbhist_t *p_hist_le;
+    msbhist_t *p_hist_be;
+    uint64_t limit;
+} endian_hists_t;
+
+/* Structure of parameters used in parallel endianness detection. */
+typedef struct {
+    endian_hists_t p_hists[2];
+    int nb_hists;
+    uint64_t start;
+    uint64_t end;
+
+    /* Barrier shared with the main thread, and end of scan flag. */
+    pthread_barrier_t *p_barrier;
+    int *p_stop;
+} endian_params_t;
+
+/* String PoI considered by select_poi_strings(). */
+typedef struct {
+    poi_t *poi;
+    uint64_t hash;
+    uint64_t size;
+} str_entry_t;
+
+/* Structure of parameters used in parallel string indexing. */
+typedef struct {
+    poi_t strings;
+    poi_t *p_last;
+    poi_t wstrings;
+    poi_t *p_wlast;
+    unsigned int min_size;
+    uint64_t start;
+    uint64_t end;
+} strings_params_t;
+
+/* Structure of parameters used in parallel array indexing (indexes of values in the pointers cache). */
+typedef struct {
+    poi_t arrays;
+    poi_t *p_last;
+    uint64_t start;
+    uint64_t end;
+} arrays_params_t;
+
 /* Structure of parameters used in parallel computing. */
 typedef struct {
     score_entry_t *p_scores;
@@ -44,18 +118,34 @@ typedef struct {
     arch_t arch;
     endianness_t endian;
     unsigned char *content;
-    unsigned int ui_content_size;
+    uint64_t u64_content_size;
     pthread_mutex_t *lock;
     int start;
     int count;
 } parallel_params_t;
 
+/* Scan kernels specialized for a pointer width and an endianness (see scan_kernels.h). */
+typedef struct {
+    void (*build_ptrcache)(ptrcache_t *p_cache);
+    int (*build_ptrindex)(ptrindex_t *p_index, uint8_t required);
+    uint64_t (*find_arrays_sync)(uint64_t index, uint64_t nb_values);
+    void (*index_poi_arrays)(arrays_params_t *params);
+    void (*index_poi_pointers)(poi_t *p_poi_list, uint64_t u64_base_address);
+    void (*register_candidates)(ptrindex_t *p_index, poi_t *poi, addrtree_node_t *p_candidates, addrarray_t *p_votes);
+} scan_kernels_t;
+
 /* Globals */
 arch_t g_target_arch;
 endianness_t g_target_endian;
 unsigned char *gp_content;
-unsigned int g_content_size;
-unsigned int g_chunk_size;
+uint64_t g_content_size;
+uint64_t g_chunk_size;
+
+/* Firmware content is mapped in memory (or read in a heap buffer). */
+static int g_content_mapped = 0;
+
+/* Pointers decoded from the firmware content (see build_ptrcache()). */
+ptrcache_t *gp_ptrcache = NULL;
 
 /* Globals used by find_base_address(). */
 base_address_candidate *gp_ba_candidates;
@@ -81,6 +171,11 @@ int g_bm_kept;
 int max_votes;
 int g_bm_processed;
 
+/* Globals used by index_poi_strings() and index_poi_arrays(). */
+uint64_t g_str_processed;
+uint64_t g_arrays_processed;
+uint64_t g_arrays_total;
+
 uint64_t g_max_address = 0xFFFFFFFFFFFFFFFF;
 unsigned int g_max_score;
 
@@ -89,13 +184,150 @@ static int g_verbose = LOGLEVEL_WARNING;
 static int g_deepmode = 0;
 static int g_show_help = 0;
 static int g_nb_threads = 1;
+static int g_struct_members = 0;
+static int g_direct_scan = 0;
+static int g_top_candidates = 0;
+static int g_sample = 0;
+static int g_hugepages = 0;
+static int g_auto_arch = 0;
+static int g_poi_budget = 0;
 static char *psz_functions_file = NULL;
+static char *psz_protocols = NULL;
+static char *psz_protocols_file = NULL;
 static poi_t *g_symbols_list = NULL;
 
+/* Functions of the symbols list indexed by offset, shared by all threads. */
+static poi_index_t *gp_symbols_index = NULL;
+
 /* Mutex to handle multi-thread processing. */
 pthread_mutex_t deep_lock = PTHREAD_MUTEX_INITIALIZER;
 
 
+/**
+ * @brief   Account for values processed by index_poi_arrays() and update the progress bar
+ * @param   nb_values   number of values processed since the last call
+ **/
+
+static void arrays_progress(uint64_t nb_values)
+{
+    uint64_t chunk_values = g_chunk_size/get_arch_pointer_size(g_target_arch) + 1;
+
+    pthread_mutex_lock(&deep_lock);
+    if (((g_arrays_processed + nb_values) / chunk_values) != (g_arrays_processed / chunk_values))
+        progress_bar(g_arrays_processed + nb_values, g_arrays_total, "Searching for PoIs...");
+    g_arrays_processed += nb_values;
+    pthread_mutex_unlock(&deep_lock);
+}
+
+/* Scan kernels, for each pointer width and endianness. */
+#define KERNEL_SUFFIX _16le
+#define KERNEL_PTR_SIZE 2
+#define KERNEL_BIG_ENDIAN 0
+#include "scan_kernels.h"
+#define KERNEL_SUFFIX _16be
+#define KERNEL_PTR_SIZE 2
+#define KERNEL_BIG_ENDIAN 1
+#include "scan_kernels.h"
+#define KERNEL_SUFFIX _24le
+#define KERNEL_PTR_SIZE 3
+#define KERNEL_BIG_ENDIAN 0
+#include "scan_kernels.h"
+#define KERNEL_SUFFIX _24be
+#define KERNEL_PTR_SIZE 3
+#define KERNEL_BIG_ENDIAN 1
+#include "scan_kernels.h"
+#define KERNEL_SUFFIX _32le
+#define KERNEL_PTR_SIZE 4
+#define KERNEL_BIG_ENDIAN 0
+#include "scan_kernels.h"
+#define KERNEL_SUFFIX _32be
+#define KERNEL_PTR_SIZE 4
+#define KERNEL_BIG_ENDIAN 1
+#include "scan_kernels.h"
+#define KERNEL_SUFFIX _64le
+#define KERNEL_PTR_SIZE 8
+#define KERNEL_BIG_ENDIAN 0
+#include "scan_kernels.h"
+#define KERNEL_SUFFIX _64be
+#define KERNEL_PTR_SIZE 8
+#define KERNEL_BIG_ENDIAN 1
+#include "scan_kernels.h"
+
+
+/**
+ * @brief   Get the scan kernels matching the target architecture and endianness
+ *
+ * Unknown endianness reads pointers as little-endian, as read_pointer() does.
+ *
+ * @return  pointer to a `scan_kernels_t` structure
+ **/
+
+const scan_kernels_t *get_scan_kernels(void)
+{
+    int big_endian = (g_target_endian == ENDIAN_BE);
+
+    switch (g_target_arch)
+    {
+        case ARCH_16:
+            return big_endian?&g_scan_kernels_16be:&g_scan_kernels_16le;
+
+        case ARCH_24:
+            return big_endian?&g_scan_kernels_24be:&g_scan_kernels_24le;
+
+        case ARCH_64:
+            return big_endian?&g_scan_kernels_64be:&g_scan_kernels_64le;
+
+        default:
+            return big_endian?&g_scan_kernels_32be:&g_scan_kernels_32le;
+    }
+}
+
+
+/**
+ * @brief   Decode the pointers found in the firmware content into `gp_ptrcache`
+ *
+ * Target architecture and endianness must be known, the pointers cache is
+ * rebuilt on each call.
+ *
+ * @return  0 on success, -1 on error
+ **/
+
+int decode_pointers(void)
+{
+    ptrcache_free(gp_ptrcache);
+    gp_ptrcache = ptrcache_alloc(g_target_arch, g_content_size);
+    if (gp_ptrcache == NULL)
+    {
+        error("Cannot allocate memory for pointers cache.\n");
+        return -1;
+    }
+
+    get_scan_kernels()->build_ptrcache(gp_ptrcache);
+    return 0;
+}
+
+
+/**
+ * @brief   Read a pointer from the firmware content, using the pointers cache if possible
+ * @param   offset  offset of the pointer
+ * @return  pointer value
+ **/
+
+static inline uint64_t read_target_pointer(uint64_t offset)
+{
+    uint64_t index;
+
+    if ((gp_ptrcache != NULL) && ((offset % gp_ptrcache->ptr_size) == 0))
+    {
+        index = offset / gp_ptrcache->ptr_size;
+        if (index < gp_ptrcache->nb_values)
+            return ptrcache_get(gp_ptrcache, index);
+    }
+
+    return read_pointer(g_target_arch, g_target_endian, gp_content, offset);
+}
+
+
 /**
  * @brief   Compute chunk size (used to optimize progress bar update)
  **/
@@ -110,67 +342,214 @@ void compute_chunk_size(void)
 }
 
 
+/**
+ * @brief   Find text strings starting in a part of the firmware (thread)
+ *
+ * A string crossing the start of the part belongs to the previous part, while
+ * a string starting in this part is followed until its end, even beyond the
+ * end of the part. Found strings are appended to `params->strings`, in order.
+ *
+ * UTF-16 strings (in target endianness, aligned on 2 bytes) are searched in
+ * each chunk right after ASCII strings, while it is still in cache, and are
+ * appended to `params->wstrings`.
+ *
+ * @param   args    pointer to a `strings_params_t` structure
+ **/
+
+void *parallel_index_strings(void *args)
+{
+    strings_params_t *params = (strings_params_t *)args;
+    uint64_t cursor, wcursor, str_start_offset;
+    uint64_t chunk, chunk_end, wchunk_end;
+    uint64_t count;
+    int big_endian = (g_target_endian == ENDIAN_BE);
+
+    cursor = params->start;
+    if ((cursor > 0) && is_printable(gp_content[cursor - 1]))
+        cursor = find_printable(gp_content, cursor, g_content_size, 0);
+
+    wcursor = (params->start + 1) & ~1ULL;
+    if ((wcursor >= 2) && ((wcursor + 2) <= g_content_size) && is_wide_printable(&gp_content[wcursor - 2], big_endian))
+        wcursor = find_wide_printable(gp_content, wcursor, g_content_size, 0, big_endian);
+
+    /* Process part by chunks to update the progress bar. */
+    for (chunk=params->start; chunk<params->end; chunk+=g_chunk_size)
+    {
+        chunk_end = ((chunk + g_chunk_size) < params->end)?(chunk + g_chunk_size):params->end;
+
+        while (cursor < chunk_end)
+        {
+            /* Skip to the first printable character. */
+            str_start_offset = find_printable(gp_content, cursor, chunk_end, 1);
+            if (str_start_offset >= chunk_end)
+                break;
+
+            /* Skip to the end of the string, strings not terminated before the end of file are ignored. */
+            cursor = find_printable(gp_content, str_start_offset + 1, g_content_size, 0);
+            if (cursor >= g_content_size)
+                break;
+
+            count = cursor - str_start_offset;
+            if (count >= params->min_size)
+            {
+                /* Add POI. */
+                if (poi_add(params->p_last, str_start_offset, count, POI_STRING) == 0)
+                    params->p_last = params->p_last->p_next;
+            }
+            cursor++;
+        }
+
+        /* Code units starting in this chunk may end in the next one. */
+        wchunk_end = ((chunk_end + 1) < g_content_size)?(chunk_end + 1):g_content_size;
+        while (wcursor < chunk_end)
+        {
+            /* Skip to the first printable character. */
+            wcursor = find_wide_printable(gp_content, wcursor, wchunk_end, 1, big_endian);
+            if ((wcursor >= chunk_end) || ((wcursor + 2) > wchunk_end))
+                break;
+            str_start_offset = wcursor;
+
+            /* Skip to the end of the string, strings not terminated before the end of file are ignored. */
+            wcursor = find_wide_printable(gp_content, str_start_offset + 2, g_content_size, 0, big_endian);
+            if ((wcursor + 2) > g_content_size)
+            {
+                wcursor = g_content_size;
+                break;
+            }
+
+            count = (wcursor - str_start_offset) / 2;
+            if (count >= params->min_size)
+            {
+                /* Add POI. */
+                if (poi_add(params->p_wlast, str_start_offset, count, POI_WSTRING) == 0)
+                    params->p_wlast = params->p_wlast->p_next;
+            }
+            wcursor += 2;
+        }
+
+        pthread_mutex_lock(&deep_lock);
+        g_str_processed += chunk_end - chunk;
+        progress_bar(g_str_processed, g_content_size, "Indexing strings ...");
+        pthread_mutex_unlock(&deep_lock);
+    }
+
+    return NULL;
+}
+
+
 /**
  * @brief   Find text strings and add them into a given list of point of interests.
+ *
+ * The firmware is split in one contiguous part per thread, and strings found
+ * in each part are appended in file order, ASCII strings first then UTF-16
+ * strings.
+ *
  * @param   p_poi_list        pointer to a list of point of interests
  * @param   ui_min_str_size   minimum size of strings
  **/
 
 void index_poi_strings(poi_t *p_poi_list, unsigned int ui_min_size)
 {
-    unsigned int cursor;
-    unsigned int count;
-    unsigned int str_start_offset;
-    int is_in_str;
-    int nb_strings;
+    pthread_t *p_threads = NULL;
+    strings_params_t *p_threads_params = NULL;
+    strings_params_t single_params;
+    poi_t *p_last, *poi;
+    uint64_t part_size;
+    int nb_threads = g_nb_threads;
+    uint64_t nb_strings, nb_wstrings;
+    int i;
 
-    cursor = 0;
-    is_in_str = 0;
-    str_start_offset = 0;
-    count = 0;
-    nb_strings = 0;
+    /* Use a single thread if parts would be smaller than a chunk. */
+    if ((uint64_t)nb_threads * g_chunk_size > g_content_size)
+        nb_threads = 1;
 
-    while (cursor < g_content_size)
+    if (nb_threads > 1)
     {
-        if (cursor % g_chunk_size == 0)
+        p_threads = (pthread_t *)malloc(sizeof(pthread_t) * nb_threads);
+        p_threads_params = (strings_params_t *)malloc(sizeof(strings_params_t) * nb_threads);
+        if ((p_threads == NULL) || (p_threads_params == NULL))
         {
-            progress_bar(cursor, g_content_size, "Indexing strings ...");
+            warning("Cannot allocate memory for multi-threaded string indexing, using a single thread.\n");
+            free(p_threads);
+            free(p_threads_params);
+            p_threads = NULL;
+            nb_threads = 1;
         }
-        if (!is_in_str)
+    }
+    if (nb_threads == 1)
+        p_threads_params = &single_params;
+
+    /* Parts start on a chunk boundary. */
+    part_size = ((g_content_size / nb_threads) / g_chunk_size) * g_chunk_size;
+    g_str_processed = 0;
+    for (i=0; i<nb_threads; i++)
+    {
+        poi_init(&p_threads_params[i].strings);
+        p_threads_params[i].p_last = &p_threads_params[i].strings;
+        poi_init(&p_threads_params[i].wstrings);
+        p_threads_params[i].p_wlast = &p_threads_params[i].wstrings;
+        p_threads_params[i].min_size = ui_min_size;
+        p_threads_params[i].start = i*part_size;
+        p_threads_params[i].end = (i == (nb_threads - 1))?g_content_size:(i + 1)*part_size;
+        if (nb_threads > 1)
+            pthread_create(&p_threads[i], NULL, parallel_index_strings, (void *)&p_threads_params[i]);
+        else
+            parallel_index_strings(&p_threads_params[i]);
+    }
+
+    /* Append strings of each part in order. */
+    nb_strings = 0;
+    p_last = poi_list_get_last_item(p_poi_list);
+    for (i=0; i<nb_threads; i++)
+    {
+        if (nb_threads > 1)
+            pthread_join(p_threads[i], NULL);
+
+        for (poi=p_threads_params[i].strings.p_next; poi!=NULL; poi=poi->p_next)
         {
-            if (isprint(gp_content[cursor]))
-            {
-                is_in_str = 1;
-                str_start_offset = cursor;
-                count = 1;
-            }
+            debug(
+                "found string of size %ld at offset %016lx\n",
+                poi->count,
+                poi->offset
+            );
+            nb_strings++;
         }
-        else
+
+        if (p_threads_params[i].strings.p_next != NULL)
         {
-            if (!isprint(gp_content[cursor]))
-            {
-                is_in_str = 0;
-                if (count >= ui_min_size)
-                {
-                    /* Add POI. */
-                    poi_add(p_poi_list, str_start_offset, count, POI_STRING);
-                    debug(
-                        "found string of size %d at offset %016lx\n",
-                        count,
-                        str_start_offset
-                    );
-                    nb_strings++;
-                }
-            }
-            else
-                count++;
+            p_last->p_next = p_threads_params[i].strings.p_next;
+            p_last = p_threads_params[i].p_last;
+        }
+    }
+
+    /* Then append UTF-16 strings. */
+    nb_wstrings = 0;
+    for (i=0; i<nb_threads; i++)
+    {
+        for (poi=p_threads_params[i].wstrings.p_next; poi!=NULL; poi=poi->p_next)
+        {
+            debug(
+                "found wide string of size %ld at offset %016lx\n",
+                poi->count,
+                poi->offset
+            );
+            nb_wstrings++;
         }
 
-        /* Go to next char. */
-        cursor++;
+        if (p_threads_params[i].wstrings.p_next != NULL)
+        {
+            p_last->p_next = p_threads_params[i].wstrings.p_next;
+            p_last = p_threads_params[i].p_wlast;
+        }
     }
     progress_bar_done();
-    logm("[i] %d strings indexed\n", nb_strings);
+    logm("[i] %lu strings indexed\n", nb_strings);
+    if (nb_wstrings > 0)
+        logm("[i] %lu wide strings indexed\n", nb_wstrings);
+
+    if (p_threads_params != &single_params)
+        free(p_threads_params);
+    free(p_threads);
 }
 
 
@@ -182,61 +561,7 @@ void index_poi_strings(poi_t *p_poi_list, unsigned int ui_min_size)
 
 void index_poi_pointers(poi_t *p_poi_list, uint64_t u64_base_address)
 {
-    unsigned int cursor=0;
-    uint64_t value;
-    memregion_type_t mem_type;
-    poi_t *poi;
-
-    while (cursor < g_content_size-get_arch_pointer_size(g_target_arch))
-    {
-        /* Read value as pointer. */
-        value = read_pointer(g_target_arch, g_target_endian, gp_content, cursor);
-
-        /* If a list of symbols have been provided, use it. */
-        if ((g_symbols_list != NULL) && (memory_get_type(cursor) != REGION_CODE))
-        {
-            /* Check if this pointer points to an existing function. */
-            poi = g_symbols_list->p_next;
-            while (poi != NULL)
-            {
-                if (((value - u64_base_address) == poi->offset) && ((poi->type == POI_FUNCTION)))
-                {
-                    poi_add(p_poi_list, cursor, 1, POI_FUNCTION_POINTER);
-                    debug("pointer %016lx points to a known function\n", value);
-                }
-                poi = poi->p_next;
-            }
-        }
-        else if (memory_get_type(cursor) != REGION_CODE)
-        {
-            /* Is this a valid pointer ? */
-            mem_type = memory_get_type(value - u64_base_address);
-            if (
-                (value >= u64_base_address) &&
-                (value < (u64_base_address + g_content_size)) &&
-                (value!=0) && 
-                (mem_type!=REGION_UNKNOWN) && 
-                (mem_type!=REGION_UNINIT_DATA)
-            )
-            {
-                /* If a pointer points into a code section, set it as a function pointer. */
-                if (mem_type == REGION_CODE)
-                {
-                    /* Add this value as a generic pointer to our PoIs (we don't know yet what it points to). */
-                    poi_add(p_poi_list, cursor, 1, POI_FUNCTION_POINTER);
-                    debug("pointer %016lx points to code, considering a function pointer\n", value);
-                }
-                else
-                {
-                    /* Add this value as a generic pointer to our PoIs (we don't know yet what it points to). */
-                    poi_add(p_poi_list, cursor, 1, POI_GENERIC_POINTER);
-                    debug("pointer %016lx points to initialized data, considering a generic pointer\n", value);
-                }
-            }
-        }
-
-        cursor += get_arch_pointer_size(g_target_arch);
-    }
+    get_scan_kernels()->index_poi_pointers(p_poi_list, u64_base_address);
 }
 
 
@@ -252,14 +577,14 @@ void index_poi_pointers(poi_t *p_poi_list, uint64_t u64_base_address)
 
 void index_poi_pointer_arrays(poi_t *p_pointer_arrays_list, poi_t *p_pointers_list, uint64_t u64_base_address)
 {
-    int i;
-    int count=0;
+    uint64_t i;
+    int64_t count=0;
     int in_array=0;
     poi_type_t pointer_type;
     poi_t *pointer;
     poi_t *array_start;
     uint64_t last_offset;
-    int nb_pointers;
+    uint64_t nb_pointers;
 
     nb_pointers = 0;
     pointer = p_pointers_list->p_next;
@@ -292,7 +617,7 @@ void index_poi_pointer_arrays(poi_t *p_pointer_arrays_list, poi_t *p_pointers_li
                 if (count > 4)
                 {
                     debug(
-                        "Found array of %d pointers @%016lx (type:%d).\n",
+                        "Found array of %ld pointers @%016lx (type:%d).\n",
                         count,
                         array_start->offset,
                         pointer_type
@@ -330,7 +655,8 @@ void structure_disp_declaration(int *signature, int nb_members, arch_t arch)
 {
     int i;
     int field_count=0;
-    char *value_type = (arch==ARCH_32)?"uint32_t":"uint64_t";
+    char *value_type = (arch==ARCH_16)?"uint16_t":((arch==ARCH_24)?"uint8_t":((arch==ARCH_64)?"uint64_t":"uint32_t"));
+    char *value_suffix = (arch==ARCH_24)?"[3]":"";
 
     printf("struct {\n");
     for (i=0; i<nb_members; i++)
@@ -338,7 +664,7 @@ void structure_disp_declaration(int *signature, int nb_members, arch_t arch)
         switch(signature[i])
         {
             case -1:
-                printf("\t%s field_%d;\n", value_type, field_count++);
+                printf("\t%s field_%d%s;\n", value_type, field_count++, value_suffix);
                 break;
 
             case POI_STRING:
@@ -346,6 +672,11 @@ void structure_disp_declaration(int *signature, int nb_members, arch_t arch)
                 printf("\tchar *psz_field_%d;\n", field_count++);
                 break;
 
+            case POI_WSTRING:
+            case POI_WSTRING_POINTER:
+                printf("\twchar_t *pwsz_field_%d;\n", field_count++);
+                break;
+
             case POI_POINTER_POINTER:
             case POI_STRUCTURE_POINTER:
             case POI_GENERIC_POINTER:
@@ -365,7 +696,7 @@ void structure_disp_declaration(int *signature, int nb_members, arch_t arch)
                 break;
 
             default:
-                printf("\t%s dw_%d;\n", value_type, field_count++);
+                printf("\t%s dw_%d%s;\n", value_type, field_count++, value_suffix);
                 break;
         }
     }
@@ -375,68 +706,59 @@ void structure_disp_declaration(int *signature, int nb_members, arch_t arch)
 
 /**
  * @brief   Create signature for a given identified structure
- * @param   p_pointers_list     pointer to a list of pointers POI
- * @param   p_strings_list      pointer to a list of text strings POI
+ *
+ * Pointers and strings are looked up by offset through hash indexes, so each
+ * member costs O(1) whatever the number of known pointers and strings.
+ *
+ * @param   p_pointers_index    pointer to an index of a sorted list of pointers POI
+ * @param   p_strings_index     pointer to an index of a list of text strings POI
  * @param   u64_base_address    base address to consider
+ * @param   offset              structure offset
  * @param   nb_members          number of members of the structure
  * @param   p_struct_sign       output structure
  **/
 
-void structure_create_signature(poi_t *p_pointers_list, poi_t *p_strings_list, uint64_t u64_base_address, uint64_t offset, int nb_members, int *p_struct_sign)
+void structure_create_signature(poi_index_t *p_pointers_index, poi_index_t *p_strings_index, uint64_t u64_base_address, uint64_t offset, int nb_members, int *p_struct_sign)
 {
     int i;
-    poi_t *item;
+    poi_t *p_member, *p_target, *item;
     uint64_t value;
+    uint64_t member_offset;
 
     /* Fill signature. */
     for (i=0; i<nb_members; i++)
     {
         /* Read value. */
-        value = read_pointer(g_target_arch, g_target_endian, gp_content, offset + i*get_arch_pointer_size(g_target_arch));
+        member_offset = offset + i*get_arch_pointer_size(g_target_arch);
+        value = read_target_pointer(member_offset);
 
         /* Member is unknown by default. */
         p_struct_sign[i] = -1;
 
-        /* Is the member a pointer onto one of our recovered pointers ? */
-        item = p_pointers_list->p_next;
-        while (item != NULL)
+        /*
+         * Is the member a pointer onto one of our recovered pointers, or is it a known
+         * pointer itself ? If both, the first one in the (sorted) list of pointers wins.
+         */
+        p_member = poi_index_lookup(p_pointers_index, member_offset);
+        p_target = poi_index_lookup(p_pointers_index, value - u64_base_address);
+        if ((p_target != NULL) && (p_target->type >= POI_GENERIC_POINTER) && ((p_member == NULL) || (p_target->offset <= p_member->offset)))
         {
-            if ((item->offset + u64_base_address) == value)
-            {
-                if (item->type >= POI_GENERIC_POINTER)
-                {
-                    p_struct_sign[i] = POI_POINTER_POINTER;
-                    break;
-                }
-            }
-            else
-            if (item->offset == (offset + i*get_arch_pointer_size(g_target_arch)))
-            {
-                /* Member IS a known pointer. */
-                p_struct_sign[i] = item->type;
-                break;
-            }
-
-
-            /* Go on with next item. */
-            item = item->p_next;
+            p_struct_sign[i] = POI_POINTER_POINTER;
+        }
+        else if ((p_member != NULL) && (p_member != p_target))
+        {
+            /* Member IS a known pointer. */
+            p_struct_sign[i] = p_member->type;
         }
 
         /* Data is not a known pointer, check if it points to a string. */
         if (p_struct_sign[i] < 0)
         {
-            item = p_strings_list->p_next;
-            while (item != NULL)
+            item = poi_index_lookup(p_strings_index, value - u64_base_address);
+            if (item != NULL)
             {
-                if ((item->offset + u64_base_address) == value)
-                {
-                    /* It points to a string, add type. */
-                    p_struct_sign[i] = item->type;
-                    break;
-                }
-
-                /* Go on with next item. */
-                item = item->p_next;
+                /* It points to a string, add type. */
+                p_struct_sign[i] = item->type;
             }
         }
         
@@ -457,31 +779,82 @@ void structure_create_signature(poi_t *p_pointers_list, poi_t *p_strings_list, u
 
 
 /**
- * @brief   Find arrays of known structures
- * @param   p_struct_list       pointer to a list of arrays of structures (output)
+ * @brief   Index pointers offsets in one bitmap per POI type
+ *
+ * Pointers are found by index_poi_pointers() on pointer-size aligned offsets,
+ * so each "is there a pointer of this type at this offset ?" check becomes a
+ * single bit test on `offset / pointer size`.
+ *
  * @param   p_pointers_list     pointer to a list of pointers POI
- * @param   p_strings_list      pointer to a list of strings POI
- * @param   u64_base_address    firmware base address
+ * @param   pp_type_bitmaps     array of POI_NULLPTR_OR_VALUE+1 bitmaps (output, NULL if type is absent)
+ * @return  number of POIs on success, -1 on error
  **/
 
-void index_poi_structure_arrays(poi_t *p_struct_list, poi_t *p_pointers_list, poi_t *p_strings_list, uint64_t u64_base_address)
+int64_t structure_index_pointer_types(poi_t *p_pointers_list, bitmap_t **pp_type_bitmaps)
 {
-    int count, nb_members, i, j;
-    int cursor, found, opt_count, opt_nb_members, min_offset;
-    poi_t *poi, *poi2;
-    int results[MAX_STRUCT_MEMBERS];
-    int sign[MAX_STRUCT_MEMBERS];
-    int nb_poi;
+    poi_t *poi;
+    int64_t nb_poi;
+    int ptr_size = get_arch_pointer_size(g_target_arch);
 
-    /* Count POIs. */
     nb_poi = 0;
     poi = p_pointers_list->p_next;
     while (poi != NULL)
     {
+        if ((poi->offset % ptr_size) == 0)
+        {
+            if (pp_type_bitmaps[poi->type] == NULL)
+            {
+                pp_type_bitmaps[poi->type] = bitmap_alloc(g_content_size/ptr_size + 1);
+                if (pp_type_bitmaps[poi->type] == NULL)
+                {
+                    error("Cannot allocate memory for structure search.\n");
+                    return -1;
+                }
+            }
+            bitmap_set(pp_type_bitmaps[poi->type], poi->offset/ptr_size);
+        }
         poi = poi->p_next;
         nb_poi++;
     }
 
+    return nb_poi;
+}
+
+
+/**
+ * @brief   Find arrays of known structures
+ * @param   p_struct_list       pointer to a list of arrays of structures (output)
+ * @param   p_pointers_list     pointer to a list of pointers POI
+ * @param   p_strings_list      pointer to a list of strings POI
+ * @param   u64_base_address    firmware base address
+ **/
+
+void index_poi_structure_arrays(poi_t *p_struct_list, poi_t *p_pointers_list, poi_t *p_strings_list, uint64_t u64_base_address)
+{
+    int nb_members, i, found, opt_nb_members;
+    int64_t count, opt_count, nb_poi, j;
+    uint64_t cursor, min_offset;
+    poi_t *poi;
+    int64_t results[MAX_STRUCT_MEMBERS];
+    int sign[MAX_STRUCT_MEMBERS];
+    int ptr_size = get_arch_pointer_size(g_target_arch);
+    bitmap_t *p_type_bitmaps[POI_NULLPTR_OR_VALUE + 1] = {NULL};
+    poi_index_t *p_pointers_index = NULL, *p_strings_index = NULL;
+
+    /* Index pointers and strings by offset, used to build signatures. */
+    p_pointers_index = poi_index_create(p_pointers_list);
+    p_strings_index = poi_index_create(p_strings_list);
+    if ((p_pointers_index == NULL) || (p_strings_index == NULL))
+    {
+        error("Cannot allocate memory for structure search.\n");
+        goto free_bitmaps;
+    }
+
+    /* Count POIs and index their offsets in one bitmap per POI type. */
+    nb_poi = structure_index_pointer_types(p_pointers_list, p_type_bitmaps);
+    if (nb_poi < 0)
+        goto free_bitmaps;
+
     /**
      * Second try here, we are trying to identify repetitions in identified pointers:
      *
@@ -507,7 +880,7 @@ void index_poi_structure_arrays(poi_t *p_struct_list, poi_t *p_pointers_list, po
          */
         if (poi->offset >= min_offset)
         {
-            memset(results, 0, sizeof(int)*MAX_STRUCT_MEMBERS);
+            memset(results, 0, sizeof(int64_t)*MAX_STRUCT_MEMBERS);
             for (nb_members = MAX_STRUCT_MEMBERS; nb_members > 1; nb_members--)
             {
                 count = 0;
@@ -515,26 +888,16 @@ void index_poi_structure_arrays(poi_t *p_struct_list, poi_t *p_pointers_list, po
                 do
                 {
                     /* Compute next pointer offset. */
-                    cursor = poi->offset + count*(nb_members*get_arch_pointer_size(g_target_arch));
+                    cursor = poi->offset + count*(nb_members*ptr_size);
 
                     /* If next offset is in our dump, count consecutive matches. */
-                    if (cursor < (g_content_size - get_arch_pointer_size(g_target_arch)))
+                    if (cursor < (g_content_size - ptr_size))
                     {
-                        found = 0;
-                        poi2 = p_pointers_list->p_next;
-                        while (poi2 != NULL)
-                        {
-                            /* if our cursor'th structure first member is a known POI of same type, consider it. */
-                            if ((poi2->offset == cursor) && (poi2->type == poi->type))
-                            {
-                                /* Known POI, let's continue. */
-                                found = 1;
-                                break;
-                            }
+                        /* if our cursor'th structure first member is a known POI of same type, consider it. */
+                        found = ((cursor % ptr_size) == 0) &&
+                                (p_type_bitmaps[poi->type] != NULL) &&
+                                bitmap_test(p_type_bitmaps[poi->type], cursor/ptr_size);
 
-                            poi2 = poi2->p_next;
-                        }
-                        
                         if (found)
                             count++;
                     }
@@ -559,8 +922,8 @@ void index_poi_structure_arrays(poi_t *p_struct_list, poi_t *p_pointers_list, po
             if ((opt_count > 3) && (opt_nb_members >= 2))
             {
                 structure_create_signature(
-                    p_pointers_list,
-                    p_strings_list,
+                    p_pointers_index,
+                    p_strings_index,
                     u64_base_address,
                     poi->offset,
                     opt_nb_members,
@@ -585,10 +948,10 @@ void index_poi_structure_arrays(poi_t *p_struct_list, poi_t *p_pointers_list, po
                     opt_nb_members,
                     sign
                 );
-                debug("Found an array of structures (%d members, %d items) at offset %016lx\n", opt_nb_members, opt_count, poi->offset);
+                debug("Found an array of structures (%d members, %ld items) at offset %016lx\n", opt_nb_members, opt_count, poi->offset);
 
                 /* Update min_offset */
-                min_offset = poi->offset + opt_count*(opt_nb_members*get_arch_pointer_size(g_target_arch));
+                min_offset = poi->offset + opt_count*(opt_nb_members*ptr_size);
             }
         }
 
@@ -596,145 +959,669 @@ void index_poi_structure_arrays(poi_t *p_struct_list, poi_t *p_pointers_list, po
         j++;
     }
     progress_bar_done();   
+
+free_bitmaps:
+    for (i=0; i<=POI_NULLPTR_OR_VALUE; i++)
+        bitmap_free(p_type_bitmaps[i]);
+    poi_index_free(p_pointers_index);
+    poi_index_free(p_strings_index);
 }
 
 
 /**
- * @brief   Checks if a provided UDS RID is valid.
- * @param   value   RID to test
- * @return  1 if RID is valid, 0 otherwise
+ * @brief   Compare structure periods function
+ * @param   a   pointer to the first period to compare
+ * @param   b   pointer to the second period to compare
+ * @return  <0 if `a` has a better autocorrelation score than `b`, >0 otherwise
  **/
 
-int is_valid_uds_rid(int value)
+int period_compare_func(const void *a, const void *b)
 {
-    return ((value == 0x10) ||
-            (value == 0x11) ||
-            (value == 0x14) ||
-            (value == 0x19) ||
-            ((value >= 0x27) && (value <=0x29)) || /* 3 */
-            (value == 0x3E) ||
-            ((value >= 0x83) && (value <= 0x87)) || /* 5 */
-            ((value >= 0x22) && (value <= 0x24)) || /* 3 */
-            (value == 0x2A) ||
-            (value == 0x2C) ||
-            (value == 0x2E) ||
-            (value == 0x2F) ||
-            (value == 0x31) ||
-            ((value >= 0x34) && (value <= 0x38)) /* 5 */
-    );
+    struct_period_t *p1 = (struct_period_t *)a;
+    struct_period_t *p2 = (struct_period_t *)b;
+
+    /* Highest score first, then smallest lag, then POI type. */
+    if (p1->score != p2->score)
+        return (p1->score > p2->score)?-1:1;
+    if (p1->lag != p2->lag)
+        return (p1->lag - p2->lag);
+    return (p1->type - p2->type);
+}
+
+
+/**
+ * @brief   Compare structure arrays function
+ * @param   a   pointer to the first structure array to compare
+ * @param   b   pointer to the second structure array to compare
+ * @return  <0 if `a` is located before `b`, >0 otherwise
+ **/
 
+int struct_array_compare_func(const void *a, const void *b)
+{
+    struct_array_t *s1 = (struct_array_t *)a;
+    struct_array_t *s2 = (struct_array_t *)b;
+
+    return (s1->offset < s2->offset)?-1:((s1->offset > s2->offset)?1:0);
 }
 
 
 /**
- * @brief   Identify UDS database based on previously found structures
- * @param   p_struct_list       pointer to a list of previously found structures
- * @param   arch                target architecture
- * @param   endian              target endianness
+ * @brief   Find arrays of known structures using autocorrelation
+ *
+ * Instead of testing every possible structure size for every pointer, this
+ * detector computes the autocorrelation of each typed pointer bitmap for lags
+ * going from 2 to `max_members` words. A lag that matches the size of an array
+ * of structures gets a high score, since most of the same-typed pointers of the
+ * array have a twin exactly `lag` words further.
+ *
+ * Lags are then processed from the highest score to the lowest, and runs of at
+ * least 4 same-typed pointers spaced by `lag` words are registered as arrays of
+ * structures. Words covered by a registered array are claimed and cannot be part
+ * of another array, which discards multiples of the real structure size.
+ *
+ * @param   p_struct_list       pointer to a list of arrays of structures (output)
+ * @param   p_pointers_list     pointer to a list of pointers POI
+ * @param   p_strings_list      pointer to a list of strings POI
  * @param   u64_base_address    firmware base address
- * @param   p_content           pointer to firmware content
- * @param   ui_content_size     size of firmware content
+ * @param   max_members         maximum number of members of a structure
  **/
 
-void identify_uds(poi_t *p_struct_list,  uint64_t u64_base_address)
+void index_poi_structure_arrays_autocorr(poi_t *p_struct_list, poi_t *p_pointers_list, poi_t *p_strings_list, uint64_t u64_base_address, int max_members)
 {
-    int k, n, count, start = 0;
-    poi_t *p_struct;
-    uint8_t udsdb[256] = {0};
+    bitmap_t *p_type_bitmaps[POI_NULLPTR_OR_VALUE + 1] = {NULL};
+    bitmap_t *p_bitmap, *p_claimed = NULL;
+    struct_period_t *p_periods = NULL;
+    struct_array_t *p_arrays = NULL, *p_new_arrays;
+    poi_index_t *p_pointers_index = NULL, *p_strings_index = NULL;
+    int *sign = NULL;
+    int nb_periods = 0;
+    uint64_t nb_arrays = 0, max_arrays = 0;
+    int ptr_size = get_arch_pointer_size(g_target_arch);
+    int i, t, lag;
+    int64_t count;
+    uint64_t score, w, bits, start, cursor, k, end;
+
+    /* Index pointers offsets, one bitmap per type. */
+    if (structure_index_pointer_types(p_pointers_list, p_type_bitmaps) < 0)
+        goto free_all;
+
+    p_periods = (struct_period_t *)malloc(sizeof(struct_period_t) * (POI_NULLPTR_OR_VALUE + 1) * max_members);
+    p_claimed = bitmap_alloc(g_content_size/ptr_size + 1);
+    sign = (int *)malloc(sizeof(int) * max_members);
+    if ((p_periods == NULL) || (p_claimed == NULL) || (sign == NULL))
+    {
+        error("Cannot allocate memory for structure search.\n");
+        goto free_all;
+    }
 
-    int best_udsdb_offset = -1;
-    int best_udsdb_start = 0;
-    int best_udsdb_size = 0;
-    int in_uds_seq = 0;
-    poi_t *best_udsdb_struct = NULL;
+    /* Compute autocorrelation of each typed pointer bitmap, keep lags with at least 3 pairs. */
+    for (t=0; t<=POI_NULLPTR_OR_VALUE; t++)
+    {
+        if (p_type_bitmaps[t] == NULL)
+            continue;
 
-    /* 
-     * We are looking for a structure member that matches an UDS ID
-     * across multiple elements of a structure array.
-     */
-    p_struct = p_struct_list->p_next;
-    while (p_struct != NULL)
-    {
-        /* We scan from offset 0 to structure-size-1. */
-        for (n=0; n<p_struct->nb_members*get_arch_pointer_size(g_target_arch); n++)
+        progress_bar(t, POI_NULLPTR_OR_VALUE + 1, "Searching structures ...");
+        for (lag=2; lag<=max_members; lag++)
         {
+            score = bitmap_autocorrelation(p_type_bitmaps[t], lag);
+            if (score >= 3)
+            {
+                p_periods[nb_periods].type = t;
+                p_periods[nb_periods].lag = lag;
+                p_periods[nb_periods++].score = score;
+            }
+        }
+    }
+    progress_bar_done();
+
+    /* Dominant periods first. */
+    qsort(p_periods, nb_periods, sizeof(struct_period_t), period_compare_func);
+
+    for (i=0; i<nb_periods; i++)
+    {
+        progress_bar(i, nb_periods, "Extracting structures ...");
+        p_bitmap = p_type_bitmaps[p_periods[i].type];
+        lag = p_periods[i].lag;
 
-            /* TODO: We must look for the longest series of valid RIDs ! */
-            in_uds_seq = 0;
-            count = 0;
-            for (k=0; k<p_struct->count; k++)
+        for (w=0; w<p_bitmap->nb_words; w++)
+        {
+            /* Unclaimed words having a same-typed pointer `lag` words further. */
+            bits = p_bitmap->p_words[w] & bitmap_get_word_at(p_bitmap, w*64 + lag) & ~p_claimed->p_words[w];
+            while (bits != 0)
             {
-                /* For each array item, takes the n-th byte and check if it is a valid UDS value. */
-                if(is_valid_uds_rid(gp_content[p_struct->offset + k*p_struct->nb_members*get_arch_pointer_size(g_target_arch) + n]))
+                start = w*64 + __builtin_ctzll(bits);
+                bits &= bits - 1;
+
+                /* Only consider the first structure of a chain. */
+                if ((start >= (uint64_t)lag) && bitmap_test(p_bitmap, start - lag) && !bitmap_test(p_claimed, start - lag))
+                    continue;
+
+                /* Count consecutive structures. */
+                count = 0;
+                cursor = start;
+                while (bitmap_test(p_bitmap, cursor) && !bitmap_test(p_claimed, cursor))
                 {
-                    if (!in_uds_seq)
-                    {
-                        memset(udsdb, 0, 0x3F);
-                        in_uds_seq = 1;
-                        start = k;
-                        udsdb[gp_content[p_struct->offset + k*p_struct->nb_members*get_arch_pointer_size(g_target_arch) + n]] = 1;
-                        count = 1;
-                    }
-                    else if (udsdb[gp_content[p_struct->offset + k*p_struct->nb_members*get_arch_pointer_size(g_target_arch) + n]] == 0)
-                    {
-                        udsdb[gp_content[p_struct->offset + k*p_struct->nb_members*get_arch_pointer_size(g_target_arch) + n]] = 1;
-                        count++;
-                    }
-                    else
+                    count++;
+                    cursor += lag;
+                }
+
+                if (count > 3)
+                {
+                    if (nb_arrays == max_arrays)
                     {
-                        in_uds_seq = 0;
-                        if (count > best_udsdb_size)
+                        max_arrays = (max_arrays == 0)?64:max_arrays*2;
+                        p_new_arrays = (struct_array_t *)realloc(p_arrays, sizeof(struct_array_t) * max_arrays);
+                        if (p_new_arrays == NULL)
                         {
-                            debug("Biggest UDS RID seq found so far: %d items in struct @%016lx (offset: %d, start: %d)\n", count, p_struct->offset, n, start);
-                            best_udsdb_offset = n;
-                            best_udsdb_size = count;
-                            best_udsdb_struct = p_struct;
-                            best_udsdb_start = start;
+                            error("Cannot allocate memory for structure search.\n");
+                            goto free_all;
                         }
+                        p_arrays = p_new_arrays;
                     }
+                    p_arrays[nb_arrays].offset = start*ptr_size;
+                    p_arrays[nb_arrays].count = count;
+                    p_arrays[nb_arrays++].nb_members = lag;
+
+                    /* Claim the whole array. */
+                    end = start + (uint64_t)count*lag;
+                    if (end > p_claimed->nb_bits)
+                        end = p_claimed->nb_bits;
+                    for (k=start; k<end; k++)
+                        bitmap_set(p_claimed, k);
+                    bits &= ~p_claimed->p_words[w];
                 }
-                else
+            }
+        }
+    }
+    progress_bar_done();
+
+    /* Index pointers and strings by offset, used to build signatures. */
+    p_pointers_index = poi_index_create(p_pointers_list);
+    p_strings_index = poi_index_create(p_strings_list);
+    if ((p_pointers_index == NULL) || (p_strings_index == NULL))
+    {
+        error("Cannot allocate memory for structure search.\n");
+        goto free_all;
+    }
+
+    /* Register arrays of structures, sorted by offset. */
+    qsort(p_arrays, nb_arrays, sizeof(struct_array_t), struct_array_compare_func);
+    for (k=0; k<nb_arrays; k++)
+    {
+        structure_create_signature(
+            p_pointers_index,
+            p_strings_index,
+            u64_base_address,
+            p_arrays[k].offset,
+            p_arrays[k].nb_members,
+            sign
+        );
+        poi_add_structure_array(
+            p_struct_list,
+            p_arrays[k].offset,
+            p_arrays[k].count,
+            p_arrays[k].nb_members,
+            sign
+        );
+        debug("Found an array of structures (%d members, %ld items) at offset %016lx\n", p_arrays[k].nb_members, p_arrays[k].count, p_arrays[k].offset);
+    }
+
+free_all:
+    for (t=0; t<=POI_NULLPTR_OR_VALUE; t++)
+        bitmap_free(p_type_bitmaps[t]);
+    bitmap_free(p_claimed);
+    poi_index_free(p_pointers_index);
+    poi_index_free(p_strings_index);
+    free(p_periods);
+    free(p_arrays);
+    free(sign);
+}
+
+
+/**
+ * @brief   Thread routine searching service IDs in columns of arrays of structures
+ *
+ * Each byte column of each array of structures is gathered once into a
+ * contiguous buffer, then the longest run of unique valid service IDs is
+ * computed for every enabled diagnostic protocol. The best column of each
+ * array is pushed to the thread's candidates heap of each protocol.
+ *
+ * @param   args    pointer to a `diag_params_t` structure.
+ **/
+
+void *parallel_identify_diag_db(void *args)
+{
+    diag_params_t *params = (diag_params_t *)args;
+    diag_protocol_t *p_protocol;
+    diag_candidate_t *p_best;
+    poi_t *p_struct;
+    uint8_t *p_column;
+    uint64_t i, k, start, max_count = 0;
+    int n, p, size;
+    int stride, nb_protocols = diag_count();
+
+    /* Allocate column buffers for the biggest array, and best columns. */
+    for (i=params->start; i<(params->start + params->count); i++)
+    {
+        if ((uint64_t)params->pp_structs[i]->count > max_count)
+            max_count = params->pp_structs[i]->count;
+    }
+    p_column = (uint8_t *)malloc(max_count + 1);
+    p_best = (diag_candidate_t *)malloc(sizeof(diag_candidate_t) * nb_protocols);
+    if ((p_column == NULL) || (p_best == NULL))
+    {
+        error("Cannot allocate memory for diagnostic database search.\n");
+        free(p_column);
+        free(p_best);
+        pthread_exit(EXIT_SUCCESS);
+    }
+
+    for (i=params->start; i<(params->start + params->count); i++)
+    {
+        p_struct = params->pp_structs[i];
+        stride = p_struct->nb_members*get_arch_pointer_size(g_target_arch);
+
+        for (p=0; p<nb_protocols; p++)
+        {
+            p_best[p].p_struct = p_struct;
+            p_best[p].index = i;
+            p_best[p].size = 0;
+        }
+
+        /* We scan from offset 0 to structure-size-1. */
+        for (n=0; n<stride; n++)
+        {
+            /* Strided gather of the n-th byte of each array item. */
+            for (k=0; k<(uint64_t)p_struct->count; k++)
+                p_column[k] = gp_content[p_struct->offset + k*stride + n];
+
+            /* Test this column against every enabled protocol. */
+            for (p=0; p<nb_protocols; p++)
+            {
+                p_protocol = diag_get(p);
+                if (!p_protocol->enabled)
+                    continue;
+
+                size = diag_longest_unique_run(p_column, p_struct->count, p_protocol, &start);
+                if (size > p_best[p].size)
                 {
-                    in_uds_seq = 0;
-                    if (count > best_udsdb_size)
-                    {
-                        debug("Biggest UDS RID seq found so far: %d items in struct @%016lx (offset: %d, start: %d)\n", count, p_struct->offset, n, start);
-                        best_udsdb_offset = n;
-                        best_udsdb_size = count;
-                        best_udsdb_start = start;
-                        best_udsdb_struct = p_struct;
-                    }
-                }   
+                    p_best[p].column = n;
+                    p_best[p].start = start;
+                    p_best[p].size = size;
+                }
             }
         }
 
+        /* Keep this array if it is one of the best candidates found so far. */
+        for (p=0; p<nb_protocols; p++)
+        {
+            if (p_best[p].size > 0)
+                diag_heap_push(&params->p_heaps[p], &p_best[p]);
+        }
+    }
+
+    free(p_column);
+    free(p_best);
+    pthread_exit(EXIT_SUCCESS);
+}
+
+
+/**
+ * @brief   Identify diagnostic databases based on previously found structures
+ *
+ * All enabled diagnostic protocols (UDS by default) are searched in a single
+ * pass over the arrays of structures. The `g_top_candidates` best databases
+ * (1 by default) are kept in a bounded heap and reported for each protocol.
+ *
+ * @param   p_struct_list       pointer to a list of previously found structures
+ * @param   u64_base_address    firmware base address
+ **/
+
+void identify_diag_db(poi_t *p_struct_list,  uint64_t u64_base_address)
+{
+    int i, j, p, nb_threads, nb_protocols, nb_heaps = 0, nb_top;
+    uint64_t k, z, nb_structs;
+    poi_t *p_struct;
+    poi_t **pp_structs = NULL;
+    diag_heap_t *p_heaps = NULL;
+    diag_heap_t top;
+    diag_candidate_t *p_best;
+    diag_protocol_t *p_protocol;
+    pthread_t *p_threads = NULL;
+    diag_params_t *p_threads_params = NULL;
+    uint64_t address;
+
+    /* Collect arrays of structures, so that threads can share them. */
+    nb_top = (g_top_candidates > 0)?g_top_candidates:1;
+    nb_protocols = diag_count();
+    nb_structs = poi_count(p_struct_list);
+    pp_structs = (poi_t **)malloc(sizeof(poi_t *) * (nb_structs + 1));
+    nb_threads = ((uint64_t)g_nb_threads < nb_structs)?g_nb_threads:(int)nb_structs;
+    if (nb_threads < 1)
+        nb_threads = 1;
+    p_threads = (pthread_t *)malloc(sizeof(pthread_t) * nb_threads);
+    p_threads_params = (diag_params_t *)malloc(sizeof(diag_params_t) * nb_threads);
+
+    /* One heap per thread and per protocol, plus one heap per protocol for the merge. */
+    p_heaps = (diag_heap_t *)malloc(sizeof(diag_heap_t) * (nb_threads + 1) * nb_protocols);
+    if ((pp_structs == NULL) || (p_heaps == NULL) || (p_threads == NULL) || (p_threads_params == NULL))
+    {
+        error("Cannot allocate memory for diagnostic database search.\n");
+        goto free_all;
+    }
+    for (nb_heaps=0; nb_heaps<((nb_threads + 1) * nb_protocols); nb_heaps++)
+    {
+        if (diag_heap_init(&p_heaps[nb_heaps], nb_top) < 0)
+        {
+            error("Cannot allocate memory for diagnostic database search.\n");
+            goto free_all;
+        }
+    }
+
+    k = 0;
+    p_struct = p_struct_list->p_next;
+    while (p_struct != NULL)
+    {
+        pp_structs[k++] = p_struct;
         p_struct = p_struct->p_next;
     }
-    progress_bar_done();
 
-    if (g_target_arch == ARCH_64)
+    /* 
+     * We are looking for a structure member that matches a service ID
+     * across multiple elements of a structure array. Arrays of structures
+     * are split among `g_nb_threads` threads.
+     */
+    z = nb_structs / nb_threads;
+    for (i=0; i<nb_threads; i++)
     {
-        /* Show UDS DB location. */
-        printf(
-            "Most probable UDS DB is located at @%016lx, found %d different UDS RID\n",
-            best_udsdb_struct->offset + u64_base_address + best_udsdb_offset+best_udsdb_start*best_udsdb_struct->nb_members*get_arch_pointer_size(g_target_arch),
-            best_udsdb_size
+        p_threads_params[i].pp_structs = pp_structs;
+        p_threads_params[i].p_heaps = &p_heaps[i*nb_protocols];
+        p_threads_params[i].start = (uint64_t)i*z;
+        p_threads_params[i].count = (i == (nb_threads - 1))?(nb_structs - (uint64_t)i*z):z;
+
+        pthread_create(
+            &p_threads[i],
+            NULL,
+            parallel_identify_diag_db,
+            (void *)&p_threads_params[i]
         );
+    }
 
-        /* Show structure. */
-        printf("Identified structure:\n");
-        structure_disp_declaration(best_udsdb_struct->signature, best_udsdb_struct->nb_members, g_target_arch);
+    /* Wait for these threads to finish. */
+    for (i=0; i<nb_threads; i++)
+    {
+        pthread_join(p_threads[i], NULL);
     }
-    else
+    progress_bar_done();
+
+    for (p=0; p<nb_protocols; p++)
     {
-        printf(
-            "Most probable UDS DB is located at @%08x, found %d different UDS RID\n",
-            (uint32_t)(best_udsdb_struct->offset + u64_base_address + best_udsdb_offset+best_udsdb_start*best_udsdb_struct->nb_members*get_arch_pointer_size(g_target_arch)),
-            best_udsdb_size
-        );
-        /* Show structure. */
-        printf("Identified structure:\n");
-        structure_disp_declaration(best_udsdb_struct->signature, best_udsdb_struct->nb_members, g_target_arch);
+        p_protocol = diag_get(p);
+        if (!p_protocol->enabled)
+            continue;
+
+        /* Merge threads candidates, ties are resolved in structures order. */
+        top = p_heaps[nb_threads*nb_protocols + p];
+        for (i=0; i<nb_threads; i++)
+        {
+            for (j=0; j<p_heaps[i*nb_protocols + p].count; j++)
+                diag_heap_push(&top, &p_heaps[i*nb_protocols + p].p_items[j]);
+        }
+
+        if (diag_heap_sort(&top) == 0)
+        {
+            printf("No %s DB found\n", p_protocol->psz_name);
+            continue;
+        }
+
+        for (j=0; j<top.count; j++)
+        {
+            p_best = &top.p_items[j];
+            debug("%s RID seq #%d: %d items in struct @%016lx (offset: %d, start: %lu)\n", p_protocol->psz_name, j + 1, p_best->size, p_best->p_struct->offset, p_best->column, p_best->start);
+
+            /* Show database location. */
+            address = p_best->p_struct->offset + u64_base_address + p_best->column + p_best->start*p_best->p_struct->nb_members*get_arch_pointer_size(g_target_arch);
+            if (j == 0)
+                printf("Most probable %s DB is located at ", p_protocol->psz_name);
+            else
+                printf("%s DB candidate #%d is located at ", p_protocol->psz_name, j + 1);
+            if (g_target_arch == ARCH_64)
+                printf("@%016lx, found %d different %s RID\n", address, p_best->size, p_protocol->psz_name);
+            else
+                printf("@%08x, found %d different %s RID\n", (uint32_t)address, p_best->size, p_protocol->psz_name);
+
+            /* Show structure. */
+            printf("Identified structure:\n");
+            structure_disp_declaration(p_best->p_struct->signature, p_best->p_struct->nb_members, g_target_arch);
+        }
+    }
+
+free_all:
+    for (i=0; i<nb_heaps; i++)
+        diag_heap_free(&p_heaps[i]);
+    free(pp_structs);
+    free(p_heaps);
+    free(p_threads);
+    free(p_threads_params);
+}
+
+
+/**
+ * @brief   Compare diagnostic tables found by direct scan
+ * @param   a   pointer to the first table to compare
+ * @param   b   pointer to the second table to compare
+ * @return  <0 if `a` is more probable than `b` (bigger, then lower offset and stride), >0 otherwise
+ **/
+
+int diag_table_compare_func(const void *a, const void *b)
+{
+    diag_table_t *t1 = (diag_table_t *)a;
+    diag_table_t *t2 = (diag_table_t *)b;
+
+    if (t1->size != t2->size)
+        return (t2->size - t1->size);
+    if (t1->offset != t2->offset)
+        return (t1->offset < t2->offset)?-1:1;
+    return (t1->stride - t2->stride);
+}
+
+
+/**
+ * @brief   Search diagnostic databases directly in raw memory
+ *
+ * Unlike identify_diag_db(), this search does not rely on pointers nor on
+ * arrays of structures: every stride and byte column of the firmware is
+ * considered, and the `g_top_candidates` most probable tables (10 by default)
+ * are reported for each enabled protocol. A base address is only used to display addresses.
+ *
+ * @param   u64_base_address    firmware base address (0 if unknown)
+ **/
+
+void scan_diag_db(uint64_t u64_base_address)
+{
+    diag_protocol_t *p_protocol;
+    diag_table_t *p_tables;
+    diag_table_t **pp_shown;
+    uint64_t address;
+    int i, j, p, nb_tables, nb_shown, nb_top, overlap;
+
+    nb_top = (g_top_candidates > 0)?g_top_candidates:DIAG_SCAN_RESULTS;
+    pp_shown = (diag_table_t **)malloc(sizeof(diag_table_t *) * nb_top);
+    if (pp_shown == NULL)
+    {
+        error("Cannot allocate memory for diagnostic database scan.\n");
+        return;
+    }
+
+    for (p=0; p<diag_count(); p++)
+    {
+        p_protocol = diag_get(p);
+        if (!p_protocol->enabled)
+            continue;
+
+        nb_tables = diag_scan_tables(p, gp_content, g_content_size, &p_tables);
+        if (nb_tables < 0)
+        {
+            error("Cannot allocate memory for diagnostic database scan.\n");
+            break;
+        }
+        debug("Found %d %s table candidates\n", nb_tables, p_protocol->psz_name);
+
+        if (nb_tables == 0)
+        {
+            printf("No %s DB found\n", p_protocol->psz_name);
+            continue;
+        }
+
+        /* Rank tables and skip the ones overlapping a more probable table. */
+        qsort(p_tables, nb_tables, sizeof(diag_table_t), diag_table_compare_func);
+        printf("Most probable %s DB candidates (direct scan):\n", p_protocol->psz_name);
+        nb_shown = 0;
+        for (i=0; (i<nb_tables) && (nb_shown<nb_top); i++)
+        {
+            overlap = 0;
+            for (j=0; (j<nb_shown) && !overlap; j++)
+            {
+                overlap = (p_tables[i].offset < (pp_shown[j]->offset + (uint64_t)pp_shown[j]->size*pp_shown[j]->stride)) &&
+                          (pp_shown[j]->offset < (p_tables[i].offset + (uint64_t)p_tables[i].size*p_tables[i].stride));
+            }
+            if (overlap)
+                continue;
+            pp_shown[nb_shown++] = &p_tables[i];
+
+            address = p_tables[i].offset + u64_base_address;
+            if (g_target_arch == ARCH_64)
+                printf("  @%016lx, stride %d, found %d different %s RID\n", address, p_tables[i].stride, p_tables[i].size, p_protocol->psz_name);
+            else
+                printf("  @%08x, stride %d, found %d different %s RID\n", (uint32_t)address, p_tables[i].stride, p_tables[i].size, p_protocol->psz_name);
+        }
+
+        free(p_tables);
+    }
+
+    free(pp_shown);
+}
+
+
+/**
+ * @brief   Load a firmware file in memory
+ *
+ * The file is mapped read-only in memory, so that its content is shared with
+ * the page cache and never copied. It is read in a heap buffer only if it
+ * cannot be mapped. With `-H`, huge pages are used if available.
+ *
+ * @param   psz_filename    path to firmware file
+ * @return  0 on success, -1 otherwise
+ **/
+
+int load_firmware(char *psz_filename)
+{
+    int fd;
+    off_t file_size;
+    void *p_content = MAP_FAILED;
+    ssize_t nb_bytes_read;
+    uint64_t offset;
+
+    /* Open file and get size. */
+    fd = open(psz_filename, O_RDONLY);
+    if (fd < 0)
+    {
+        /* Failed to open file. */
+        printf("[!] Cannot access file '%s'\r\n", psz_filename);
+        return -1;
+    }
+
+    /* Get file size (also works with block devices). */
+    file_size = lseek(fd, 0, SEEK_END);
+    if (file_size < 0)
+    {
+        printf("[!] Cannot access file '%s'\r\n", psz_filename);
+        close(fd);
+        return -1;
+    }
+    g_content_size = file_size;
+    compute_chunk_size();
+
+    gp_content = NULL;
+    g_content_mapped = 0;
+    if (g_content_size == 0)
+    {
+        close(fd);
+        return 0;
+    }
+
+    /* Map file content, using huge pages if asked to. */
+#ifdef MAP_HUGETLB
+    if (g_hugepages)
+        p_content = mmap(NULL, g_content_size, PROT_READ, MAP_PRIVATE | MAP_HUGETLB, fd, 0);
+#endif
+    if (p_content == MAP_FAILED)
+    {
+        p_content = mmap(NULL, g_content_size, PROT_READ, MAP_PRIVATE, fd, 0);
+#ifdef MADV_HUGEPAGE
+        if (g_hugepages && (p_content != MAP_FAILED))
+            madvise(p_content, g_content_size, MADV_HUGEPAGE);
+#endif
+    }
+
+    if (p_content != MAP_FAILED)
+    {
+        /* Content is mostly read from start to end, read it ahead. */
+        madvise(p_content, g_content_size, MADV_SEQUENTIAL);
+        madvise(p_content, g_content_size, MADV_WILLNEED);
+
+        gp_content = (unsigned char *)p_content;
+        g_content_mapped = 1;
+        close(fd);
+        return 0;
+    }
+
+    /* Cannot map this file, allocate enough memory to store content. */
+    gp_content = (unsigned char *)malloc(g_content_size);
+    if (gp_content == NULL)
+    {
+        printf("[!] Cannot allocate memory for file %s (%lu bytes is too large)\r\n", psz_filename, g_content_size);
+        close(fd);
+        return -1;
+    }
+
+    /* Read file content. */
+    lseek(fd, 0, SEEK_SET);
+    for (offset = 0; offset < g_content_size; offset += nb_bytes_read)
+    {
+        nb_bytes_read = read(fd, gp_content + offset, g_content_size - offset);
+        if (nb_bytes_read <= 0)
+        {
+            printf("[!] Cannot read file '%s'\r\n", psz_filename);
+            free(gp_content);
+            gp_content = NULL;
+            close(fd);
+            return -1;
+        }
+    }
+    close(fd);
+
+    return 0;
+}
+
+
+/**
+ * @brief   Release firmware content loaded by load_firmware(), and the pointers decoded from it
+ **/
+
+void unload_firmware(void)
+{
+    ptrcache_free(gp_ptrcache);
+    gp_ptrcache = NULL;
+
+    if (gp_content != NULL)
+    {
+        if (g_content_mapped)
+            munmap(gp_content, g_content_size);
+        else
+            free(gp_content);
+        gp_content = NULL;
+        g_content_mapped = 0;
     }
 }
 
@@ -749,14 +1636,13 @@ void identify_uds(poi_t *p_struct_list,  uint64_t u64_base_address)
 
 void index_functions(poi_t *p_poi_list)
 {
-    uint64_t ba_mask, final_mask=0x0, ptr_h;
-    int nb_pointers, nb_pointers_prev;
-    int i,j,k,z;
-    unsigned int cursor;
-    uint64_t value, v;
-    addrtree_node_t *p_addr_tree = NULL;
-    int in_ary = 0, nb_items=0;
-    poi_t *poi;
+    uint64_t value, value_or, value_and, low, prev_low;
+    int64_t j;
+    int i, z;
+    int ptr_size = get_arch_pointer_size(g_target_arch);
+    int is_code;
+    poi_t *poi, *p_last;
+    poi_index_t *p_index;
     uint64_t max_code_addr = 0;
     memregion_t *region;
 
@@ -775,8 +1661,23 @@ void index_functions(poi_t *p_poi_list)
         region = memregion_enum_next(region);
     }    
 
+    /* No code, no function. */
+    if (max_code_addr == 0)
+        return;
+
     /* Compute lowest mask. */
     z = log2(max_code_addr);
+    if (z > 31)
+        return;
+
+    /* Index known POIs by offset, functions are only added once. */
+    p_index = poi_index_create(p_poi_list);
+    if (p_index == NULL)
+    {
+        error("Cannot allocate memory for functions search.\n");
+        return;
+    }
+    p_last = poi_list_get_last_item(p_poi_list);
 
     poi = p_poi_list->p_next;
     while (poi != NULL)
@@ -784,43 +1685,312 @@ void index_functions(poi_t *p_poi_list)
         /* Check if it is an array of values. */
         if (poi->type == POI_ARRAY)
         {
-            /* Check the highest mask that matches all these values. */
-            k = poi->count;
-            for (i=31; (i>(z-1)) && (k == poi->count) ; i--)
+            /*
+             * All values must share the same bits from bit z, whatever the mask
+             * between bits 31 and z. Check it first with a single OR/AND pass.
+             */
+            value_or = 0;
+            value_and = 0xffffffffffffffff;
+            for (j=0; j<poi->count; j++)
             {
-                ba_mask = 0xffffffffffffffff << i;
-                cursor = 0;
-                nb_pointers = 0;
+                value = read_target_pointer(poi->offset + j*ptr_size);
+                value_or |= value;
+                value_and &= value;
+            }
 
-                k = 1;
-                value = read_pointer(g_target_arch, g_target_endian, gp_content, poi->offset);
-                if (memory_get_type(value & (~ba_mask)) == REGION_CODE)
+            if (((value_or ^ value_and) >> z) == 0)
+            {
+                /* The lower bits of each value must point to code, for every mask. */
+                is_code = 1;
+                for (j=0; (j<poi->count) && is_code; j++)
                 {
-                    ptr_h = value & ba_mask;
-                    for (j=1; j<poi->count; j++)
+                    value = read_target_pointer(poi->offset + j*ptr_size);
+                    prev_low = 0xffffffffffffffff;
+                    for (i=31; (i>(z-1)) && is_code; i--)
                     {
-                        value = read_pointer(g_target_arch, g_target_endian, gp_content, poi->offset +j*get_arch_pointer_size(g_target_arch));
-                        if ( ((value & ba_mask) != ptr_h) || (memory_get_type(value & (~ba_mask)) != REGION_CODE) )
-                            break;
-                        else
-                            k++;
+                        low = value & ~(0xffffffffffffffff << i);
+                        if (low != prev_low)
+                            is_code = (memory_get_type(low) == REGION_CODE);
+                        prev_low = low;
+                    }
+                }
+
+                /* Register items as function pointers, using the lowest mask. */
+                if (is_code)
+                {
+                    for (j=0; j<poi->count; j++)
+                    {
+                        value = read_target_pointer(poi->offset + j*ptr_size) & ~(0xffffffffffffffff << z);
+                        if (poi_index_lookup(p_index, value) == NULL)
+                        {
+                            if (poi_add(p_last, value, -1, POI_FUNCTION) < 0)
+                                break;
+                            p_last = p_last->p_next;
+
+                            /* Stop there, next functions could not be checked for duplicates. */
+                            if (poi_index_add(p_index, p_last) < 0)
+                            {
+                                error("Cannot allocate memory for functions search.\n");
+                                poi_index_free(p_index);
+                                return;
+                            }
+                        }
                     }
                 }
             }
+        }
+
+        poi = poi->p_next;
+    }
+
+    poi_index_free(p_index);
+}
+
+
+/**
+ * @brief   Compare string PoIs by content hash, size, then offset (qsort callback)
+ **/
+
+int str_entry_compare_content(const void *a, const void *b)
+{
+    const str_entry_t *p_a = (const str_entry_t *)a;
+    const str_entry_t *p_b = (const str_entry_t *)b;
+
+    if (p_a->hash != p_b->hash)
+        return (p_a->hash < p_b->hash)?-1:1;
+    if (p_a->size != p_b->size)
+        return (p_a->size < p_b->size)?-1:1;
+    if (p_a->poi->offset != p_b->poi->offset)
+        return (p_a->poi->offset < p_b->poi->offset)?-1:1;
+    return 0;
+}
+
+
+/**
+ * @brief   Compare string PoIs by decreasing length (qsort callback)
+ **/
+
+int str_entry_compare_length(const void *a, const void *b)
+{
+    const str_entry_t *p_a = (const str_entry_t *)a;
+    const str_entry_t *p_b = (const str_entry_t *)b;
+
+    if (p_a->poi->count != p_b->poi->count)
+        return (p_a->poi->count > p_b->poi->count)?-1:1;
+    return 0;
+}
+
+
+/**
+ * @brief   Keep the most informative string PoIs, up to a given number
+ *
+ * Strings located in code regions and strings having the same content as a
+ * previous one are removed. If more than `budget` strings remain, the minimum
+ * length of strings is raised until at most `budget` strings are kept, so that
+ * the cost of voting stays bounded on noisy firmwares. Other PoIs are kept.
+ *
+ * @param   p_poi_list  pointer to a list of point of interests
+ * @param   budget      maximum number of string PoIs to keep
+ **/
+
+void select_poi_strings(poi_t *p_poi_list, int budget)
+{
+    str_entry_t *p_entries;
+    poi_t *poi, *prev;
+    uint64_t nb_entries, nb_strings, nb_kept;
+    uint64_t i, j, k;
+    int64_t min_length;
+
+    /* Count string PoIs. */
+    nb_strings = 0;
+    for (poi=p_poi_list->p_next; poi!=NULL; poi=poi->p_next)
+    {
+        if ((poi->type == POI_STRING) || (poi->type == POI_WSTRING))
+            nb_strings++;
+    }
+    if (nb_strings == 0)
+        return;
+
+    p_entries = (str_entry_t *)malloc(sizeof(str_entry_t) * nb_strings);
+    if (p_entries == NULL)
+    {
+        warning("Cannot allocate memory for string selection, keeping all strings.\n");
+        return;
+    }
+
+    /* Hash content of strings outside of code regions (FNV-1a). */
+    nb_entries = 0;
+    for (poi=p_poi_list->p_next; poi!=NULL; poi=poi->p_next)
+    {
+        if ((poi->type != POI_STRING) && (poi->type != POI_WSTRING))
+            continue;
+
+        if (memory_get_type(poi->offset) == REGION_CODE)
+        {
+            /* Strings with a null count are removed below. */
+            poi->count = 0;
+            continue;
+        }
+
+        p_entries[nb_entries].poi = poi;
+        p_entries[nb_entries].size = (poi->type == POI_WSTRING)?(2*(uint64_t)poi->count):(uint64_t)poi->count;
+        p_entries[nb_entries].hash = 0xcbf29ce484222325ULL;
+        for (k=0; k<p_entries[nb_entries].size; k++)
+            p_entries[nb_entries].hash = (p_entries[nb_entries].hash ^ gp_content[poi->offset + k]) * 0x100000001b3ULL;
+        nb_entries++;
+    }
+
+    /* Remove duplicates, keeping the first occurrence of each content. */
+    qsort(p_entries, nb_entries, sizeof(str_entry_t), str_entry_compare_content);
+    for (i=0, j=0; i<nb_entries; i++)
+    {
+        if ((j > 0) &&
+            (p_entries[i].hash == p_entries[j-1].hash) &&
+            (p_entries[i].size == p_entries[j-1].size) &&
+            !memcmp(&gp_content[p_entries[i].poi->offset], &gp_content[p_entries[j-1].poi->offset], p_entries[i].size))
+        {
+            p_entries[i].poi->count = 0;
+        }
+        else
+            p_entries[j++] = p_entries[i];
+    }
+    nb_entries = j;
+
+    /* Raise the minimum length if the budget is exceeded. */
+    min_length = STR_MIN_SIZE;
+    nb_kept = nb_entries;
+    if (nb_entries > (uint64_t)budget)
+    {
+        qsort(p_entries, nb_entries, sizeof(str_entry_t), str_entry_compare_length);
+        min_length = p_entries[budget].poi->count + 1;
+        for (nb_kept=budget; (nb_kept > 0) && (p_entries[nb_kept-1].poi->count < min_length); nb_kept--);
+        for (i=nb_kept; i<nb_entries; i++)
+            p_entries[i].poi->count = 0;
+    }
+    free(p_entries);
+
+    /* Remove strings that have not been kept. */
+    prev = p_poi_list;
+    while ((poi = prev->p_next) != NULL)
+    {
+        if (((poi->type == POI_STRING) || (poi->type == POI_WSTRING)) && (poi->count == 0))
+        {
+            prev->p_next = poi->p_next;
+            free(poi);
+        }
+        else
+            prev = poi;
+    }
+
+    logm("[i] %lu strings kept out of %lu (minimum length: %ld)\n", nb_kept, nb_strings, min_length);
+}
+
+
+/**
+ * @brief   Find arrays of similar values in a part of the firmware (thread)
+ * @param   args    pointer to an `arrays_params_t` structure
+ **/
+
+void *parallel_index_arrays(void *args)
+{
+    get_scan_kernels()->index_poi_arrays((arrays_params_t *)args);
+
+    return NULL;
+}
+
+
+/**
+ * @brief   Find arrays of similar values and add them into a given list of point of interests.
+ *
+ * The firmware is split in one part per thread, each part starting right after
+ * a value from which arrays can be searched independently (see
+ * find_arrays_sync()), and arrays found in each part are appended in file order.
+ *
+ * @param   p_poi_list  pointer to a list of point of interests
+ **/
+
+void index_poi_arrays(poi_t *p_poi_list)
+{
+    const scan_kernels_t *p_kernels = get_scan_kernels();
+    pthread_t *p_threads = NULL;
+    arrays_params_t *p_threads_params = NULL;
+    arrays_params_t single_params;
+    poi_t *p_last, *poi;
+    uint64_t nb_values, part_size, sync;
+    int nb_threads = g_nb_threads;
+    int i;
+
+    /* Values are searched up to the last complete pointer, excluded. */
+    nb_values = (g_content_size - 1) / get_arch_pointer_size(g_target_arch);
+    g_arrays_processed = 0;
+    g_arrays_total = nb_values;
+
+    if ((uint64_t)nb_threads * ARRAYS_MIN_THREAD_VALUES > nb_values)
+        nb_threads = 1;
+
+    if (nb_threads > 1)
+    {
+        p_threads = (pthread_t *)malloc(sizeof(pthread_t) * nb_threads);
+        p_threads_params = (arrays_params_t *)malloc(sizeof(arrays_params_t) * nb_threads);
+        if ((p_threads == NULL) || (p_threads_params == NULL))
+        {
+            warning("Cannot allocate memory for multi-threaded array indexing, using a single thread.\n");
+            free(p_threads);
+            free(p_threads_params);
+            p_threads = NULL;
+            nb_threads = 1;
+        }
+    }
+    if (nb_threads == 1)
+        p_threads_params = &single_params;
+
+    /* Each part ends where the next one starts. */
+    part_size = nb_values / nb_threads;
+    for (i=nb_threads-1; i>=0; i--)
+    {
+        poi_init(&p_threads_params[i].arrays);
+        p_threads_params[i].p_last = &p_threads_params[i].arrays;
+        p_threads_params[i].end = (i == (nb_threads - 1))?nb_values:p_threads_params[i + 1].start;
+        if (i == 0)
+        {
+            p_threads_params[i].start = 0;
+        }
+        else
+        {
+            /* A part without any synchronization value is left to the previous one. */
+            sync = p_kernels->find_arrays_sync(i*part_size, p_threads_params[i].end);
+            p_threads_params[i].start = (sync < p_threads_params[i].end)?(sync + 1):p_threads_params[i].end;
+        }
+    }
+
+    for (i=0; i<nb_threads; i++)
+    {
+        if (nb_threads > 1)
+            pthread_create(&p_threads[i], NULL, parallel_index_arrays, (void *)&p_threads_params[i]);
+        else
+            parallel_index_arrays(&p_threads_params[i]);
+    }
 
-            /* ba_mask is our best shot for this array, register items as function pointers. */
-            if (k == poi->count)
-            {
-                for (i=0; i<poi->count; i++)
-                {
-                    value = read_pointer(g_target_arch, g_target_endian, gp_content, poi->offset +i*get_arch_pointer_size(g_target_arch));
-                    poi_add_unique(p_poi_list, value & (~ba_mask), -1, POI_FUNCTION);
-                }
-            }
-        }
+    /* Append arrays of each part in order. */
+    p_last = poi_list_get_last_item(p_poi_list);
+    for (i=0; i<nb_threads; i++)
+    {
+        if (nb_threads > 1)
+            pthread_join(p_threads[i], NULL);
 
-        poi = poi->p_next;
+        for (poi=p_threads_params[i].arrays.p_next; poi!=NULL; poi=poi->p_next)
+            debug("Found array of %ld values at offset 0x%016lx\n", poi->count, poi->offset);
+
+        if (p_threads_params[i].arrays.p_next != NULL)
+        {
+            p_last->p_next = p_threads_params[i].arrays.p_next;
+            p_last = p_threads_params[i].p_last;
+        }
     }
+
+    if (p_threads_params != &single_params)
+        free(p_threads_params);
+    free(p_threads);
 }
 
 
@@ -832,13 +2002,6 @@ void index_functions(poi_t *p_poi_list)
 
 void index_poi(poi_t *p_poi_list, int include_strings)
 {
-    unsigned int cursor = 0;
-    unsigned int ary_start_offset;
-    int is_in_ary=0;
-    int count = 0;
-    uint64_t value;
-    uint64_t prev_u64;
-
     /* First, index text strings. */
     if (include_strings)
     {
@@ -846,53 +2009,7 @@ void index_poi(poi_t *p_poi_list, int include_strings)
     }
 
     /* Next, index arrays of similar values. */
-    cursor = 0;
-    is_in_ary = 0;
-    ary_start_offset = 0;
-    count = 0;
-
-    while (cursor < g_content_size-get_arch_pointer_size(g_target_arch))
-    {
-        if (cursor % g_chunk_size == 0)
-        {
-            progress_bar(cursor, g_content_size-get_arch_pointer_size(g_target_arch), "Searching for PoIs...");
-        }
-        value = read_pointer(g_target_arch, g_target_endian, gp_content, cursor);
-
-        if (!is_in_ary)
-        {
-            if (value!=0x0 && value!=((g_target_arch==ARCH_32)?0xffffffff:0xffffffffffffffff) /*&& (value>=g_ptr_base)*/)
-            {
-                ary_start_offset = cursor;
-                is_in_ary = 1;
-                count = 0;
-            }
-        }
-        else
-        {
-            if (abs(value - prev_u64) > 0x1000)
-            {
-                is_in_ary = 0;
-                if (count > 8)
-                {
-                    /* Add POI. */
-                    poi_add(p_poi_list, ary_start_offset, count, POI_ARRAY);
-                    debug("Found array of %d values at offset 0x%016lx\n", count, ary_start_offset);
-                }
-
-                count = 0;
-            }
-            else
-            {
-                count++;
-            }
-        }
-
-        prev_u64 = value;
-
-        /* Next item. */
-        cursor += get_arch_pointer_size(g_target_arch);
-    }
+    index_poi_arrays(p_poi_list);
 
     /* Remove progress bar. */
     progress_bar_done();
@@ -997,7 +2114,8 @@ uint8_t is_ptr_aligned(uint64_t u64_address, arch_t arch){
  **/
 
 void *parallel_refine_candidates(void *args) {
-    int i,j;
+    int i;
+    int64_t j;
     parallel_params_t *params = (parallel_params_t *)args;
     uint64_t delta, v;
     int found_one_valid_array=0;
@@ -1036,12 +2154,12 @@ void *parallel_refine_candidates(void *args) {
                 p_array_values = addrtree_node_alloc();
                 for (j=0; j<poi->count; j++)
                 {
-                    v = read_pointer(params->arch, params->endian, params->content, poi->offset + j*get_arch_pointer_size(params->arch));
+                    v = read_target_pointer(poi->offset + j*get_arch_pointer_size(params->arch));
 
                     zap = params->p_poi_list->p_next;
                     while (zap != NULL)
                     {
-                        if (((zap->type == POI_STRING) || (zap->type == POI_ARRAY)) && (v == (zap->offset + delta)))
+                        if (((zap->type == POI_STRING) || (zap->type == POI_WSTRING) || (zap->type == POI_ARRAY)) && (v == (zap->offset + delta)))
                         {
                             addrtree_register_address(p_array_values, v);
                             break;
@@ -1053,7 +2171,7 @@ void *parallel_refine_candidates(void *args) {
                 addrtree_node_free(p_array_values);
                 if ((n_str_ptr >= (poi->count/3)) && (poi->count >= 10))
                 {
-                    info("Found a valid array of pointers (%d valid pointers on %d)\n", n_str_ptr, poi->count);
+                    info("Found a valid array of pointers (%d valid pointers on %ld)\n", n_str_ptr, poi->count);
                     found_one_valid_array = 1;
                 }
                 array_score += n_str_ptr;
@@ -1103,24 +2221,44 @@ void compute_candidates(
 )
 {
     poi_t *poi;
-    unsigned int cursor;
-    uint64_t delta;
-    uint64_t v;
-    uint64_t freespace;
     int count;
     uint64_t max_address = 0xFFFFFFFFFFFFFFFF;
     int i,j,z;
     int nb_candidates = 0;
-    unsigned int memsize;
+    uint64_t memsize;
     score_entry_t *p_scores;
     pthread_t *p_threads = NULL;
     parallel_params_t *p_threads_params = NULL;
+    addrarray_t *p_votes = NULL;
+    ptrindex_t *p_index = NULL;
+    const scan_kernels_t *p_kernels = get_scan_kernels();
     int b_has_str = 0;
 
+    /* Narrow address spaces are small enough to use a flat array of votes. */
+    if (get_arch_pointer_size(g_target_arch) < 4)
+    {
+        p_votes = addrarray_alloc(get_arch_pointer_size(g_target_arch)*8);
+        if (p_votes == NULL)
+        {
+            error("Cannot allocate memory for base address candidates.\n");
+            return;
+        }
+    }
+
+    /* List candidate pointers once, grouped by their lowest bits. */
+    p_index = ptrindex_alloc(g_mem_alignment_mask);
+    if ((p_index == NULL) || (p_kernels->build_ptrindex(p_index, PTRCACHE_NOT_ASCII | (ptr_aligned?PTRCACHE_ALIGNED:0)) < 0))
+    {
+        error("Cannot allocate memory for base address candidates.\n");
+        ptrindex_free(p_index);
+        addrarray_free(p_votes);
+        return;
+    }
+
     poi = p_poi_list->p_next;
     while (poi != NULL)
     {
-        if ((poi->type == POI_STRING) && !b_has_str)
+        if (((poi->type == POI_STRING) || (poi->type == POI_WSTRING)) && !b_has_str)
         {
             b_has_str = 1;
         }
@@ -1137,47 +2275,24 @@ void compute_candidates(
         while ((poi != NULL))
         {
             progress_bar(i, nb_candidates, "Analyzing ...");
-            for (cursor=0; cursor<g_content_size; cursor+=((g_target_arch==ARCH_32)?4:8))
-            {
-                v = read_pointer(g_target_arch, g_target_endian, gp_content, cursor);
-
-                /* Candidate pointer must not be made of ASCII. */
-                /* Add heuristic because pointer should be aligned on 4bytes/8bytes 
-                 * if v % get_arch_pointer_size(arch) != 0 --> not aligned 
-                 * */
-                if ((v & g_mem_alignment_mask) == (poi->offset & g_mem_alignment_mask) && 
-                    !is_ascii_ptr(v, g_target_arch) && 
-                    is_ptr_aligned(v,g_target_arch))
-                {
-                    /* If PoI is a string, we expect a pointer on its first character. */
-                    if ( ((b_has_str == 1) && (poi->type == POI_STRING)) || ((b_has_str == 0) && (poi->type == POI_FUNCTION)) )
-                    //if ( ((b_has_str == 1) && (poi->type == POI_STRING)) || (poi->type == POI_FUNCTION) )
-                    {
-                        if (v>=poi->offset)
-                        {
-                            delta = (v - poi->offset);
 
-                            freespace = ( ((g_target_arch==ARCH_32)?0xffffffff:0xffffffffffffffff) - delta) + 1;
-                            if (freespace >= g_content_size)
-                            {
-                                /* register candidate. */
-                                addrtree_register_address(p_candidates, (uint64_t)delta);
-                            }
-                        }
-                    }
-                }
+            /* If PoI is a string, we expect a pointer on its first character. */
+            if ( ((b_has_str == 1) && ((poi->type == POI_STRING) || (poi->type == POI_WSTRING))) || ((b_has_str == 0) && (poi->type == POI_FUNCTION)) )
+            //if ( ((b_has_str == 1) && (poi->type == POI_STRING)) || (poi->type == POI_FUNCTION) )
+            {
+                p_kernels->register_candidates(p_index, poi, p_candidates, p_votes);
             }
 
             /* Does the memory used exceed our limited space ? */
-            memsize = addrtree_get_memsize(p_candidates);
+            memsize = (p_votes == NULL)?addrtree_get_memsize(p_candidates):0;
             if (memsize>MAX_MEM_AMOUNT)
             {
                 memsize = addrtree_get_memsize(p_candidates);
-                info("[mem] Memory tree is too big (%d bytes), reducing...\r\n", memsize);
+                info("[mem] Memory tree is too big (%lu bytes), reducing...\r\n", memsize);
                 max_votes = addrtree_max_vote(p_candidates);
                 addrtree_filter(p_candidates, max_votes/2);   
                 memsize = addrtree_get_memsize(p_candidates);
-                info("[mem] Memory tree reduced to %d bytes\r\n", memsize);
+                info("[mem] Memory tree reduced to %lu bytes\r\n", memsize);
             }
 
             poi = poi->p_next;
@@ -1189,7 +2304,10 @@ void compute_candidates(
         g_bm_votes = -1;
         g_bm_total_votes = 0;
         g_bm_count=0;
-        addrtree_browse(p_candidates, find_best_match, 0);
+        if (p_votes != NULL)
+            addrarray_browse(p_votes, find_best_match);
+        else
+            addrtree_browse(p_candidates, find_best_match, 0);
 
         logm("[i] Found %d base addresses to test\n", g_bm_count);
 
@@ -1203,10 +2321,18 @@ void compute_candidates(
         gp_ba_candidates = (base_address_candidate *)malloc(sizeof(base_address_candidate) * g_bm_count);
         if (gp_ba_candidates != NULL)
         {
-            max_votes = addrtree_max_vote(p_candidates);
             g_bm_kept = 0;
             gp_ba_candidates_index = 0;
-            addrtree_browse(p_candidates, fill_best_matches, 0);
+            if (p_votes != NULL)
+            {
+                max_votes = addrarray_max_vote(p_votes);
+                addrarray_browse(p_votes, fill_best_matches);
+            }
+            else
+            {
+                max_votes = addrtree_max_vote(p_candidates);
+                addrtree_browse(p_candidates, fill_best_matches, 0);
+            }
             info("tree browsed\n");
 
             if (g_target_arch == ARCH_64)
@@ -1290,7 +2416,7 @@ void compute_candidates(
                         p_threads_params[i].arch = g_target_arch;
                         p_threads_params[i].endian = g_target_endian;
                         p_threads_params[i].content = gp_content;
-                        p_threads_params[i].ui_content_size = g_content_size;
+                        p_threads_params[i].u64_content_size = g_content_size;
                         p_threads_params[i].lock = &deep_lock;
                         p_threads_params[i].start = i*z;
                         p_threads_params[i].count = z;
@@ -1394,30 +2520,493 @@ void compute_candidates(
                     printf(" More base addresses to consider (just in case):\n");
                     for (i=0; i<((g_bm_kept>30)?30:g_bm_kept); i++)
                     {
-                        if ((p_scores[i].base_address != max_address) && (p_scores[i].score > 0))
-                        {
-                            if (g_target_arch == ARCH_64)
-                                printf("  0x%016lx (%f)\n", p_scores[i].base_address, (float)p_scores[i].score/p_scores[0].score);
-                            else
-                                printf("  0x%08x (%.02f)\n", (uint32_t)p_scores[i].base_address, (float)p_scores[i].score/p_scores[0].score);
-                        }
+                        if ((p_scores[i].base_address != max_address) && (p_scores[i].score > 0))
+                        {
+                            if (g_target_arch == ARCH_64)
+                                printf("  0x%016lx (%f)\n", p_scores[i].base_address, (float)p_scores[i].score/p_scores[0].score);
+                            else
+                                printf("  0x%08x (%.02f)\n", (uint32_t)p_scores[i].base_address, (float)p_scores[i].score/p_scores[0].score);
+                        }
+                    }
+                }
+            }
+            else
+            {
+                error("Cannot evaluate, low memory !\n");
+            }
+
+            /* Free scores. */
+            free(p_scores);
+        }
+
+    }
+    else
+        error("No point of interests found, cannot deduce loading address.");
+
+    ptrindex_free(p_index);
+    addrarray_free(p_votes);
+}
+
+/**
+ * @brief   Count MSBs of the values found in a part of the firmware
+ * @param   p_hists     array of LE and BE MSB histograms
+ * @param   nb_hists    number of items in `p_hists`
+ * @param   start       offset of the first value to count
+ * @param   end         offset of the last value to count (excluded)
+ **/
+
+void endian_hists_scan(endian_hists_t *p_hists, int nb_hists, uint64_t start, uint64_t end)
+{
+    int i;
+
+    for (i=0; i<nb_hists; i++)
+    {
+        if (start < p_hists[i].limit)
+        {
+            msbhist_scan(
+                p_hists[i].p_hist_le,
+                p_hists[i].p_hist_be,
+                gp_content,
+                start,
+                (end > p_hists[i].limit)?p_hists[i].limit:end
+            );
+        }
+    }
+}
+
+
+/**
+ * @brief   Tell if LE and BE MSB histograms are filtered once a part is counted
+ * @param   p_hist      pointer to LE and BE MSB histograms
+ * @param   start       offset of the first value of the part
+ * @param   end         offset of the last value of the part (excluded)
+ * @return  1 if the part ends on a filtering offset, 0 otherwise
+ **/
+
+int endian_hist_filtered(endian_hists_t *p_hist, uint64_t start, uint64_t end)
+{
+    uint64_t part_end = (end > p_hist->limit)?p_hist->limit:end;
+
+    return (start < p_hist->limit) && (((part_end - 1) % 0x10000) == 0);
+}
+
+
+/**
+ * @brief   Forget MSBs counted less than half of the best MSB, if a part ends on a filtering offset
+ * @param   p_hists     array of LE and BE MSB histograms
+ * @param   nb_hists    number of items in `p_hists`
+ * @param   start       offset of the first value of the part
+ * @param   end         offset of the last value of the part (excluded)
+ **/
+
+void endian_hists_filter(endian_hists_t *p_hists, int nb_hists, uint64_t start, uint64_t end)
+{
+    int i;
+
+    for (i=0; i<nb_hists; i++)
+    {
+        if (endian_hist_filtered(&p_hists[i], start, end))
+        {
+            msbhist_filter(p_hists[i].p_hist_le, msbhist_max(p_hists[i].p_hist_le)/2);
+            msbhist_filter(p_hists[i].p_hist_be, msbhist_max(p_hists[i].p_hist_be)/2);
+        }
+    }
+}
+
+
+/**
+ * @brief   Add the MSBs counted in a part to LE and BE MSB histograms
+ *
+ * If the part ends on a filtering offset, sparse MSBs not counted yet are only
+ * added if the part counts them at least half as much as the current best MSB,
+ * as the filtering that follows would forget them anyway.
+ *
+ * @param   p_hists     array of LE and BE MSB histograms
+ * @param   p_parts     array of LE and BE MSB histograms of the part
+ * @param   nb_hists    number of items in `p_hists` and `p_parts`
+ * @param   start       offset of the first value of the part
+ * @param   end         offset of the last value of the part (excluded)
+ **/
+
+void endian_hists_merge(endian_hists_t *p_hists, endian_hists_t *p_parts, int nb_hists, uint64_t start, uint64_t end)
+{
+    int i, filtered;
+
+    for (i=0; i<nb_hists; i++)
+    {
+        filtered = endian_hist_filtered(&p_hists[i], start, end);
+        msbhist_merge(p_hists[i].p_hist_le, p_parts[i].p_hist_le, filtered?msbhist_max(p_hists[i].p_hist_le)/2:0);
+        msbhist_merge(p_hists[i].p_hist_be, p_parts[i].p_hist_be, filtered?msbhist_max(p_hists[i].p_hist_be)/2:0);
+    }
+}
+
+
+/**
+ * @brief   Thread routine counting MSBs of the values found in parts of the firmware
+ *
+ * The thread counts a part (possibly empty) each time the main thread releases
+ * the barrier, then waits on it again until the main thread has merged its
+ * histograms. It ends when the stop flag is set.
+ *
+ * @param   args    pointer to a `endian_params_t` structure.
+ **/
+
+void *parallel_detect_endianness(void *args)
+{
+    endian_params_t *params = (endian_params_t *)args;
+    int i;
+
+    for (;;)
+    {
+        /* Wait for the next part. */
+        pthread_barrier_wait(params->p_barrier);
+        if (*params->p_stop)
+            break;
+
+        if (params->start < params->end)
+        {
+            for (i=0; i<params->nb_hists; i++)
+            {
+                msbhist_reset(params->p_hists[i].p_hist_le);
+                msbhist_reset(params->p_hists[i].p_hist_be);
+            }
+            endian_hists_scan(params->p_hists, params->nb_hists, params->start, params->end);
+        }
+
+        /* Let the main thread merge this part. */
+        pthread_barrier_wait(params->p_barrier);
+    }
+
+    pthread_exit(EXIT_SUCCESS);
+}
+
+
+/**
+ * @brief   Count MSBs of the values found at every offset of the firmware
+ *
+ * MSBs counted less than half of the best MSB are forgotten right after offset 0
+ * and every 0x10000 bytes, as addrtree-based detection did to save memory. This
+ * does not cost much with flat histograms, and gives the same results.
+ *
+ * With more than one thread, consecutive parts of the firmware between two
+ * of these filterings are counted by `g_nb_threads` threads into their own
+ * histograms, which are then added in file order and filtered exactly as in
+ * a single-threaded scan, giving identical results. Threads are started once
+ * and synchronized with a barrier for each round of parts.
+ *
+ * All the histograms of `p_hists` (32-bit and 64-bit values when guessing the
+ * architecture) are filled part by part, while each part is still in cache.
+ *
+ * @param   p_hists     array of LE and BE MSB histograms, the first one having the highest limit
+ * @param   nb_hists    number of items in `p_hists`
+ **/
+
+void detect_endianness_scan(endian_hists_t *p_hists, int nb_hists)
+{
+    uint64_t cursor, end, limit;
+    pthread_t *p_threads = NULL;
+    endian_params_t *p_threads_params = NULL;
+    pthread_barrier_t barrier;
+    int i, j, nb_threads, nb_parts, nb_allocated = 0, stop = 0;
+
+    limit = p_hists[0].limit;
+
+    /* Allocate per-thread histograms. */
+    nb_threads = g_nb_threads;
+    if (nb_threads > 1)
+    {
+        p_threads = (pthread_t *)malloc(sizeof(pthread_t) * nb_threads);
+        p_threads_params = (endian_params_t *)calloc(nb_threads, sizeof(endian_params_t));
+        if ((p_threads != NULL) && (p_threads_params != NULL))
+        {
+            for (nb_allocated=0; nb_allocated<nb_threads; nb_allocated++)
+            {
+                p_threads_params[nb_allocated].nb_hists = nb_hists;
+                for (j=0; j<nb_hists; j++)
+                {
+                    p_threads_params[nb_allocated].p_hists[j].p_hist_le = msbhist_alloc(p_hists[j].p_hist_le->width, p_hists[j].p_hist_le->shift);
+                    p_threads_params[nb_allocated].p_hists[j].p_hist_be = msbhist_alloc(p_hists[j].p_hist_be->width, p_hists[j].p_hist_be->shift);
+                    p_threads_params[nb_allocated].p_hists[j].limit = p_hists[j].limit;
+                    if ((p_threads_params[nb_allocated].p_hists[j].p_hist_le == NULL) || (p_threads_params[nb_allocated].p_hists[j].p_hist_be == NULL))
+                        break;
+                }
+                if (j < nb_hists)
+                    break;
+            }
+        }
+        if (nb_allocated < nb_threads)
+        {
+            warning("Cannot allocate memory for multi-threaded endianness detection, using a single thread.\n");
+            nb_threads = 1;
+        }
+    }
+
+    /* Start threads, they wait for their first part. */
+    if (nb_threads > 1)
+    {
+        pthread_barrier_init(&barrier, NULL, nb_threads + 1);
+        for (i=0; i<nb_threads; i++)
+        {
+            p_threads_params[i].p_barrier = &barrier;
+            p_threads_params[i].p_stop = &stop;
+            pthread_create(&p_threads[i], NULL, parallel_detect_endianness, (void *)&p_threads_params[i]);
+        }
+    }
+
+    for (cursor=0; cursor<limit; cursor=end)
+    {
+        end = ((cursor + 0xffff) & ~0xffffULL) + 1;
+        if (end > limit)
+            end = limit;
+
+        if (nb_threads > 1)
+        {
+            /* Count the next `nb_threads` parts in parallel. */
+            for (nb_parts=0; nb_parts<nb_threads; nb_parts++)
+            {
+                end = ((cursor + 0xffff) & ~0xffffULL) + 1;
+                if (end > limit)
+                    end = limit;
+
+                p_threads_params[nb_parts].start = cursor;
+                p_threads_params[nb_parts].end = end;
+                cursor = end;
+            }
+            pthread_barrier_wait(&barrier);
+            pthread_barrier_wait(&barrier);
+
+            /* Merge them in file order, filtering as a single thread would do. */
+            for (i=0; (i<nb_parts) && (p_threads_params[i].start<p_threads_params[i].end); i++)
+            {
+                endian_hists_merge(p_hists, p_threads_params[i].p_hists, nb_hists, p_threads_params[i].start, p_threads_params[i].end);
+                endian_hists_filter(p_hists, nb_hists, p_threads_params[i].start, p_threads_params[i].end);
+            }
+        }
+        else
+        {
+            endian_hists_scan(p_hists, nb_hists, cursor, end);
+            endian_hists_filter(p_hists, nb_hists, cursor, end);
+        }
+
+        progress_bar(end, limit, "Guessing endianness ...");
+    }
+    progress_bar_done();
+
+    /* Stop threads. */
+    if (nb_threads > 1)
+    {
+        stop = 1;
+        pthread_barrier_wait(&barrier);
+        for (i=0; i<nb_threads; i++)
+            pthread_join(p_threads[i], NULL);
+        pthread_barrier_destroy(&barrier);
+    }
+
+    if (p_threads_params != NULL)
+    {
+        for (i=0; i<g_nb_threads; i++)
+        {
+            for (j=0; j<p_threads_params[i].nb_hists; j++)
+            {
+                msbhist_free(p_threads_params[i].p_hists[j].p_hist_le);
+                msbhist_free(p_threads_params[i].p_hists[j].p_hist_be);
+            }
+        }
+    }
+    free(p_threads);
+    free(p_threads_params);
+}
+
+
+/**
+ * @brief   Compute the greatest common divisor of two numbers
+ * @param   a   first number
+ * @param   b   second number
+ * @return  greatest common divisor of `a` and `b`
+ **/
+
+uint64_t gcd(uint64_t a, uint64_t b)
+{
+    uint64_t r;
+
+    while (b != 0)
+    {
+        r = a % b;
+        a = b;
+        b = r;
+    }
+
+    return a;
+}
+
+
+/**
+ * @brief   Guess the pointer width from 32-bit and 64-bit MSB histograms
+ *
+ * Pointers of a 64-bit firmware are also counted by 32-bit reads (their least
+ * significant half), while 64-bit reads of a 32-bit firmware glue unrelated
+ * 32-bit words together. Values are considered as 64-bit pointers if:
+ *
+ * - the best 64-bit MSB has its upper 32 bits all cleared or all set, as
+ *   pointers to the lowest or highest 4GB of the address space,
+ * - the best 64-bit MSB is counted at least once for every `ARCH_AUTO_RATIO`
+ *   counts of the best 32-bit MSB,
+ * - the best 64-bit MSB is counted more than once (null MSB is registered
+ *   once beforehand, and random data rarely share a 64-bit MSB).
+ *
+ * @param   p_hists     array of 32-bit then 64-bit LE and BE MSB histograms
+ * @param   nb_hists    number of items in `p_hists`
+ * @return  index of the histograms matching the pointer width in `p_hists`
+ **/
+
+int detect_pointer_width(endian_hists_t *p_hists, int nb_hists)
+{
+    uint64_t max_32, max_le, max_be;
+    uint64_t key_le, key_be, msb;
+
+    /* Width is known. */
+    if (nb_hists < 2)
+        return 0;
+
+    max_32 = msbhist_max(p_hists[0].p_hist_le);
+    if (msbhist_max(p_hists[0].p_hist_be) > max_32)
+        max_32 = msbhist_max(p_hists[0].p_hist_be);
+
+    key_le = msbhist_first_max(p_hists[1].p_hist_le, &max_le);
+    key_be = msbhist_first_max(p_hists[1].p_hist_be, &max_be);
+    debug("Max number of 32-bit pointers: %lu, of 64-bit pointers if LE: %lu, if BE: %lu\n", max_32, max_le, max_be);
+    if (max_be > max_le)
+    {
+        key_le = key_be;
+        max_le = max_be;
+    }
+
+    msb = key_le << p_hists[1].p_hist_le->shift;
+    if (((msb >> 32) != 0) && ((msb >> 32) != 0xffffffff))
+        return 0;
+
+    if ((max_le <= 1) || (((uint64_t)max_le * ARCH_AUTO_RATIO) < max_32))
+        return 0;
+
+    return 1;
+}
+
+
+/**
+ * @brief   Count MSBs of the values found in blocks sampled across the firmware
+ *
+ * Blocks of `SAMPLE_BLOCK_SIZE` bytes are taken from all memory regions but
+ * uninitialized data ones, and visited in an order spreading them across the
+ * firmware. Every `SAMPLE_ROUND_BLOCKS` blocks, the highest LE and BE counts
+ * are compared: if both endiannesses were equally likely, each of the
+ * `max_le + max_be` best values would be LE or BE with the same probability,
+ * so the gap `|max_le - max_be|` is tested against its standard deviation
+ * `sqrt(max_le + max_be)`. Sampling stops as soon as the gap is significant
+ * for the pointer width guessed from the blocks sampled so far.
+ *
+ * @param   p_hists     array of LE and BE MSB histograms, the first one having the highest limit
+ * @param   nb_hists    number of items in `p_hists`
+ * @return  1 if the gap between LE and BE counts is significant, 0 otherwise
+ **/
+
+int detect_endianness_sample(endian_hists_t *p_hists, int nb_hists)
+{
+    memregion_t *p_region;
+    uint64_t *p_blocks = NULL;
+    uint64_t offset, start, end, limit, sampled = 0;
+    uint64_t i, j, step, nb_blocks = 0;
+    uint64_t max_le, max_be;
+    double z_score = 0.0;
+    int significant = 0;
+    int width;
+
+    /* List blocks of non-uninitialized memory regions. */
+    limit = p_hists[0].limit;
+    for (i=0; i<2; i++)
+    {
+        nb_blocks = 0;
+        p_region = memregion_enum_first();
+        while (p_region != NULL)
+        {
+            if (p_region->type != REGION_UNINIT_DATA)
+            {
+                for (offset=p_region->offset; (offset<(p_region->offset + p_region->size)) && (offset<limit); offset+=SAMPLE_BLOCK_SIZE)
+                {
+                    if (p_blocks != NULL)
+                    {
+                        /* Block start and end, within region and file limits. */
+                        end = offset + SAMPLE_BLOCK_SIZE;
+                        if (end > (p_region->offset + p_region->size))
+                            end = p_region->offset + p_region->size;
+                        p_blocks[2*nb_blocks] = offset;
+                        p_blocks[2*nb_blocks + 1] = (end > limit)?limit:end;
                     }
+                    nb_blocks++;
                 }
             }
-            else
-            {
-                error("Cannot evaluate, low memory !\n");
-            }
+            p_region = memregion_enum_next(p_region);
+        }
 
-            /* Free scores. */
-            free(p_scores);
+        if ((i == 0) && (nb_blocks > 0))
+        {
+            p_blocks = (uint64_t *)malloc(sizeof(uint64_t) * 2 * nb_blocks);
+            if (p_blocks == NULL)
+                return 0;
         }
+    }
 
+    if (nb_blocks == 0)
+    {
+        printf("[i] No memory region to sample, scanning the whole file\r\n");
+        return 0;
     }
-    else
-        error("No point of interests found, cannot deduce loading address.");
+
+    /* Visit blocks with a step coprime with the number of blocks (golden ratio). */
+    step = (uint64_t)(nb_blocks * 0.6180339887);
+    if (step == 0)
+        step = 1;
+    while (gcd(step, nb_blocks) != 1)
+        step++;
+
+    for (i=0; i<nb_blocks; i++)
+    {
+        j = (i * step) % nb_blocks;
+        start = p_blocks[2*j];
+        end = p_blocks[2*j + 1];
+
+        endian_hists_scan(p_hists, nb_hists, start, end);
+        sampled += end - start;
+        progress_bar(i, nb_blocks, "Sampling endianness ...");
+
+        if ((((i + 1) >= SAMPLE_MIN_BLOCKS) && (((i + 1) % SAMPLE_ROUND_BLOCKS) == 0)) || ((i + 1) == nb_blocks))
+        {
+            width = detect_pointer_width(p_hists, nb_hists);
+            max_le = msbhist_max(p_hists[width].p_hist_le);
+            max_be = msbhist_max(p_hists[width].p_hist_be);
+            z_score = fabs((double)max_le - (double)max_be)/sqrt((double)max_le + (double)max_be);
+            debug("Sampled %d blocks, max LE: %lu, max BE: %lu, z-score: %f\n", i + 1, max_le, max_be, z_score);
+            if (z_score >= SAMPLE_Z_SCORE)
+            {
+                significant = 1;
+                break;
+            }
+        }
+    }
+    progress_bar_done();
+
+    printf(
+        "[i] Sampled %.2f%% of the file, endianness confidence is %.3f%%\r\n",
+        (100.0*sampled)/g_content_size,
+        100.0*erf(z_score/sqrt(2.0))
+    );
+    if (!significant)
+        printf("[i] Sampling is not conclusive, scanning the whole file\r\n");
+
+    free(p_blocks);
+    return significant;
 }
 
+
 /**
  * @brief   Endianness detection
  *
@@ -1431,10 +3020,14 @@ void compute_candidates(
  * a specific MSB with a greater count when decoding with correct endianness.
  *
  * The idea is to compute and compare these counts in order to determine the supposed
- * endianness. We use a memory address tree to keep track of these counts without
- * eating up too much memory, and filter it regularly to save memory. By doing so,
- * we will end up with two memory address trees representing the different MSBs
- * used in the firmware, and then compare the counts of each root branches.
+ * endianness. We use MSB histograms (flat arrays of counters indexed by MSBs) to
+ * keep track of these counts, so that counting a value is a single increment. By
+ * doing so, we will end up with two histograms representing the different MSBs
+ * used in the firmware, and then compare their highest counts.
+ *
+ * If the architecture is unknown (`-a auto`), both 32-bit and 64-bit values are
+ * counted during the same pass, and `g_target_arch` is set to the pointer width
+ * guessed by `detect_pointer_width()` before comparing counts of this width.
  *
  * @param   u64_pointer_base    pointer base value
  * @param   u64_pointer_mask    pointer mask
@@ -1443,157 +3036,95 @@ void compute_candidates(
 endianness_t detect_endianness(uint64_t *u64_pointer_base, uint64_t *u64_pointer_mask)
 {
     endianness_t endian = ENDIAN_UNKNOWN;
-    unsigned int i;
-    int chunk_size;
-    int nbits,max_le,max_be,n,m,j;
-    int msb_le = 0, msb_be = 0;
+    endian_hists_t p_hists[2];
+    unsigned int nbits, width, shift;
+    uint64_t max_le, max_be;
     uint64_t le_ptr_base;
     uint64_t be_ptr_base;
-    int max_votes;
-    uint64_t address,mask, address_be;
-    addrtree_node_t *p_candidates_le, *p_candidates_be, *s_candidates_le, *s_candidates_be, *p_zap;
-
-    /* Compute chunk size (used to update progress bar). */
-    chunk_size = (g_content_size / 100);
-    if (chunk_size == 0)
-        chunk_size = 10;
+    int i, nb_hists, found;
 
-    /* Compute MSB mask. */
+    /* Compute MSB shift (keys are values masked with ~0 << shift). */
     nbits = log10(g_content_size)/log10(2);
-    mask = (0xffffffffffffffff << (nbits-1));
 
-    /* Parse the firmware. */
-    p_candidates_le = addrtree_node_alloc();
-    p_candidates_be = addrtree_node_alloc();
-    addrtree_register_address(p_candidates_le, 0);
-    addrtree_register_address(p_candidates_be, 0);
-
-    for (i=0; i<g_content_size - get_arch_pointer_size(g_target_arch); i++)
+    /* Allocate MSB histograms for each possible width, and register null MSB once. */
+    memset(p_hists, 0, sizeof(p_hists));
+    for (nb_hists=0; nb_hists<(g_auto_arch?2:1); nb_hists++)
     {
-        if (i % chunk_size == 0)
-        {
-            progress_bar(i, (g_content_size - get_arch_pointer_size(g_target_arch)), "Guessing endianness ...");
-        }
-
-        /* Read LE and BE address from firmware at offset i. */
-        address = read_pointer(g_target_arch, ENDIAN_LE, gp_content, i);
-        address_be = read_pointer(g_target_arch, ENDIAN_BE, gp_content, i);
-
-        /* Register masked addresses (LE and BE). */
-        if ((address != 0x0) && ((address%4)==0))
-            addrtree_register_address(p_candidates_le, address&mask);
-        if ((address_be != 0x0) && ((address_be%4)==0))
-            addrtree_register_address(p_candidates_be, address_be&mask);
-
-        /* Cleanup memory each 0x10000 iterations. */
-        if ((i%0x10000)==0)
-        {
-            max_votes = addrtree_max_vote(p_candidates_le);
-            addrtree_filter(p_candidates_le, max_votes/2);   
-            
-            max_votes = addrtree_max_vote(p_candidates_be);
-            addrtree_filter(p_candidates_be, max_votes/2);
-        }
-
-    }
-    progress_bar_done();
-
-    /*
-      If arch is ARCH_32, addresses are stored on the last 4 bytes, so we need
-      to skip the first 4 bytes.
-
-      We need to keep track of the address tree root nodes because `p_candidates_le` and
-      `p_candidates_be` may be updated if current architecture is ARCH_32.
-    */
-    s_candidates_le = p_candidates_le;
-    s_candidates_be = p_candidates_be;
+        width = get_arch_pointer_size(g_auto_arch?((nb_hists == 0)?ARCH_32:ARCH_64):g_target_arch)*8;
+        if (g_content_size < (width/8))
+            break;
 
-    if (g_target_arch == ARCH_32)
-    {
-        for (i=0;i<4;i++)
-        {
-            p_candidates_le = p_candidates_le->subs[0];
-            p_candidates_be = p_candidates_be->subs[0];
-        }
-    }
+        /* Keep at least 256 possible MSBs with 16-bit and 24-bit values. */
+        shift = nbits - 1;
+        if ((width < 32) && (shift > (width - 8)))
+            shift = width - 8;
 
-    /* Compute max counts for LE and BE. */
-    max_le = 0;
-    max_be = 0;
-    for (i=0;i<256;i++)
-    {
-        if (p_candidates_le->subs[i]!=NULL)
-        {
-            n = addrtree_max_vote(p_candidates_le->subs[i]);
-            if (n>max_le)
-                max_le = n;
-        }
-        
-        if (p_candidates_be->subs[i]!=NULL)
+        p_hists[nb_hists].p_hist_le = msbhist_alloc(width, shift);
+        p_hists[nb_hists].p_hist_be = msbhist_alloc(width, shift);
+        p_hists[nb_hists].limit = g_content_size - width/8;
+        if ((p_hists[nb_hists].p_hist_le == NULL) || (p_hists[nb_hists].p_hist_be == NULL))
         {
-            n = addrtree_max_vote(p_candidates_be->subs[i]);
-            if (n>max_be)
-                max_be=n;
+            error("Cannot allocate memory for endianness detection.\n");
+            for (i=0; i<=nb_hists; i++)
+            {
+                msbhist_free(p_hists[i].p_hist_le);
+                msbhist_free(p_hists[i].p_hist_be);
+            }
+            return ENDIAN_UNKNOWN;
         }
+        msbhist_register(p_hists[nb_hists].p_hist_le, 0);
+        msbhist_register(p_hists[nb_hists].p_hist_be, 0);
     }
 
-    debug("Max number of pointers if LE: %d\n", max_le);
-    debug("Max number of pointers if BE: %d\n", max_be);
+    /* Not even one pointer to count. */
+    if (nb_hists == 0)
+        return ENDIAN_UNKNOWN;
 
-    /* Search for LE MSB bytes (2). */
-    le_ptr_base = 0;
-    p_zap = p_candidates_le;
-    for (i=0;i<get_arch_pointer_size(g_target_arch)/2; i++)
+    /* Sample the firmware if asked to, scan it entirely otherwise or if not conclusive. */
+    if (!g_sample || !detect_endianness_sample(p_hists, nb_hists))
     {
-        n=0;
-        for (j=0;j<256;j++)
+        if (g_sample)
         {
-            if (p_zap->subs[j] != NULL)
+            for (i=0; i<nb_hists; i++)
             {
-                m = addrtree_max_vote(p_zap->subs[j]);
-                if (m>n)
-                {
-                    msb_le = j;
-                    n = m;
-                }
+                msbhist_reset(p_hists[i].p_hist_le);
+                msbhist_reset(p_hists[i].p_hist_be);
+                msbhist_register(p_hists[i].p_hist_le, 0);
+                msbhist_register(p_hists[i].p_hist_be, 0);
             }
         }
-
-        le_ptr_base = (le_ptr_base << 8) | msb_le;
-        p_zap = p_zap->subs[msb_le];
+        detect_endianness_scan(p_hists, nb_hists);
     }
 
-    /* Search for BE MSB bytes (2). */
-    be_ptr_base = 0;
-    p_zap = p_candidates_be;
-    for (i=0;i<get_arch_pointer_size(g_target_arch)/2; i++)
+    /* Deduce the pointer width if unknown. */
+    found = detect_pointer_width(p_hists, nb_hists);
+    if (g_auto_arch)
     {
-        n=0;
-        for (j=0;j<256;j++)
-        {
-            if (p_zap->subs[j] != NULL)
-            {
-                m = addrtree_max_vote(p_zap->subs[j]);
-                if (m>n)
-                {
-                    msb_be = j;
-                    n = m;
-                }
-            }
-        }
-
-        be_ptr_base = (be_ptr_base << 8) | msb_be;
-        p_zap = p_zap->subs[msb_be];
+        g_target_arch = (found == 1)?ARCH_64:ARCH_32;
+        printf("[i] %s architecture detected\r\n", (g_target_arch == ARCH_32)?"32-bit":"64-bit");
     }
+    width = p_hists[found].p_hist_le->width;
+    shift = p_hists[found].p_hist_le->shift;
+
+    /*
+     * Compute max counts for LE and BE, and pointer bases: the most significant
+     * half of the smallest MSB having the highest count.
+     */
+    le_ptr_base = (msbhist_first_max(p_hists[found].p_hist_le, &max_le) << shift) >> (width/2);
+    be_ptr_base = (msbhist_first_max(p_hists[found].p_hist_be, &max_be) << shift) >> (width/2);
 
+    debug("Max number of pointers if LE: %lu\n", max_le);
+    debug("Max number of pointers if BE: %lu\n", max_be);
 
     /* Deduce the architecture. */
     if (max_be>max_le)
     {
-        *u64_pointer_base = be_ptr_base << 16;
+        *u64_pointer_base = (width < 32)?(be_ptr_base << (width/2)):(be_ptr_base << 16);
         *u64_pointer_mask = (g_target_arch == ARCH_32)?0xffff0000:0xffff000000000000;
+        if (width < 32)
+            *u64_pointer_mask = get_arch_pointer_mask(g_target_arch) & ~((1ULL << (width/2)) - 1);
 
-        if (g_target_arch == ARCH_32)
+        if (g_target_arch != ARCH_64)
             debug("Pointer base: %08x\n", *u64_pointer_base & 0xffffffff);
         else
             debug("Pointer base: %016lx\n", *u64_pointer_base);
@@ -1602,10 +3133,12 @@ endianness_t detect_endianness(uint64_t *u64_pointer_base, uint64_t *u64_pointer
     }
     else
     {
-        *u64_pointer_base = le_ptr_base << 48;
+        *u64_pointer_base = (width < 32)?(le_ptr_base << (width/2)):(le_ptr_base << 48);
         *u64_pointer_mask = (g_target_arch == ARCH_32)?0xffff0000:0xffff000000000000;
+        if (width < 32)
+            *u64_pointer_mask = get_arch_pointer_mask(g_target_arch) & ~((1ULL << (width/2)) - 1);
 
-        if (g_target_arch == ARCH_32)
+        if (g_target_arch != ARCH_64)
             debug("Pointer base: %08x\n", *u64_pointer_base & 0xffffffff);
         else
             debug("Pointer base: %016lx\n", *u64_pointer_base);
@@ -1613,9 +3146,12 @@ endianness_t detect_endianness(uint64_t *u64_pointer_base, uint64_t *u64_pointer
         endian = ENDIAN_LE;
     }
 
-    /* Free address tree nodes. */
-    addrtree_node_free(s_candidates_le);
-    addrtree_node_free(s_candidates_be);
+    /* Free MSB histograms. */
+    for (i=0; i<nb_hists; i++)
+    {
+        msbhist_free(p_hists[i].p_hist_le);
+        msbhist_free(p_hists[i].p_hist_be);
+    }
 
     /* Return endianness. */
     return endian;
@@ -1631,99 +3167,87 @@ endianness_t detect_endianness(uint64_t *u64_pointer_base, uint64_t *u64_pointer
 
 void find_base_address(char *psz_filename)
 {
-    FILE *f_file;
     poi_t *poi;
     int nb_strings;
 
     /* Initialize our list. */
     poi_init(&g_poi_list);
     
-    /* Open file and get size. */
-    f_file = fopen(psz_filename, "rb");
-    if (f_file == NULL)
+    /* Map file content. */
+    if (load_firmware(psz_filename) == 0)
     {
-        /* Failed to open file. */
-        printf("[!] Cannot access file '%s'\r\n", psz_filename);
-    }
-    else
-    {
-        /* Set file cursor to the end. */
-        fseek(f_file, 0, SEEK_END);
-
-        /* Get file size. */
-        g_content_size = ftell(f_file);
-
         /* File size must be at least the size of the target architecture's pointer size. */
         if (g_content_size >= get_arch_pointer_size(g_target_arch))
         {
-            /* Determine file chunk size. */
-            compute_chunk_size();
+            printf("[i] File read (%lu bytes)\r\n", g_content_size);
 
-            /* Go back to the beginning of this file. */
-            fseek(f_file, 0, SEEK_SET);
+            /* Analyze entropy. */
+            memory_analyze(gp_content, g_content_size, "default");
 
-            /* Allocate enough memory to store content. */
-            gp_content = (unsigned char *)malloc(g_content_size);
-            if (gp_content == NULL)
+            if ((g_target_endian != ENDIAN_UNKNOWN) && g_auto_arch)
             {
-                printf("[!] Cannot allocate memory for file %s (%d bytes is too large)\r\n", psz_filename, g_content_size);
+                /* Guess the architecture, keeping the provided endianness. */
+                detect_endianness(&g_ptr_base, &g_ptr_mask);
+            }
+            else if (g_target_endian != ENDIAN_UNKNOWN)
+            { 
+                /* Detect endianness, pointer base and mask. */
+                //detect_endianness(arch, p_file_content, ui_file_size, &g_ptr_base, &g_ptr_mask);
+
+                /* Force endianness. */
+                g_target_endian = g_target_endian;
             }
             else
             {
-                /* Read file content. */
-                fread(gp_content, g_content_size, 1, f_file);
-                printf("[i] File read (%d bytes)\r\n", g_content_size);
-
-                /* Analyze entropy. */
-                memory_analyze(gp_content, g_content_size, "default");
+                /* Endianness is unknown, try to guess it. */
+                g_target_endian = detect_endianness(&g_ptr_base, &g_ptr_mask);
+            }
 
-                if (g_target_endian != ENDIAN_UNKNOWN)
-                { 
-                    /* Detect endianness, pointer base and mask. */
-                    //detect_endianness(arch, p_file_content, ui_file_size, &g_ptr_base, &g_ptr_mask);
+            if (g_target_endian != ENDIAN_UNKNOWN)
+            {
+                printf("[i] Endianness is %s\r\n", (g_target_endian==ENDIAN_LE)?"LE":"BE");
 
-                    /* Force endianness. */
-                    g_target_endian = g_target_endian;
-                }
-                else
+                /* Decode pointers once for all the analysis phases. */
+                if (decode_pointers() < 0)
                 {
-                    /* Endianness is unknown, try to guess it. */
-                    g_target_endian = detect_endianness(&g_ptr_base, &g_ptr_mask);
+                    unload_firmware();
+                    return;
                 }
 
-                if (g_target_endian != ENDIAN_UNKNOWN)
+                if (g_symbols_list == NULL)
                 {
-                    printf("[i] Endianness is %s\r\n", (g_target_endian==ENDIAN_LE)?"LE":"BE");
-                    
-                    if (g_symbols_list == NULL)
-                    {
-                        /* Search points of interest. */
-                        index_poi(&g_poi_list, 1);
+                    /* Search points of interest. */
+                    index_poi(&g_poi_list, 1);
+                    if (g_poi_budget > 0)
+                        select_poi_strings(&g_poi_list, g_poi_budget);
 
-                        index_functions(&g_poi_list);
+                    index_functions(&g_poi_list);
 
-                        g_candidates = addrtree_node_alloc();
-                        compute_candidates(&g_poi_list, g_candidates);
-                    }
-                    else
-                    {
-                        /* Index strings. */
-                        index_poi(g_symbols_list, 1);
-
-                        g_candidates = addrtree_node_alloc();
-                        compute_candidates(g_symbols_list, g_candidates);
-                    }                
+                    g_candidates = addrtree_node_alloc();
+                    compute_candidates(&g_poi_list, g_candidates);
                 }
                 else
                 {
-                    printf("[!] Unable to detect endianness :X\r\n");
-                }
+                    /* Index strings. */
+                    index_poi(g_symbols_list, 1);
+                    if (g_poi_budget > 0)
+                        select_poi_strings(g_symbols_list, g_poi_budget);
+
+                    g_candidates = addrtree_node_alloc();
+                    compute_candidates(g_symbols_list, g_candidates);
+                }                
+            }
+            else
+            {
+                printf("[!] Unable to detect endianness :X\r\n");
             }
         }
         else
         {
             printf("[!] Input file must be at least %d bytes.\r\n", get_arch_pointer_size(g_target_arch));
         }
+
+        unload_firmware();
     }
 }
 
@@ -1736,11 +3260,9 @@ void find_base_address(char *psz_filename)
 
 void find_coherent_data(char *psz_filename, uint64_t u64_base_address)
 {
-    FILE *f_file;
-    unsigned int ui_file_size;
-    unsigned char *p_file_content;
     uint64_t value;
     memregion_type_t mem_type;
+    endianness_t endian;
 
     poi_t *next, *next2;
     poi_t p_pointers_list;
@@ -1757,144 +3279,155 @@ void find_coherent_data(char *psz_filename, uint64_t u64_base_address)
     poi_init(&p_pointer_arrays_list);
     poi_init(&p_sorted_pointers);
 
-    /* Open file and get size. */
-    f_file = fopen(psz_filename, "rb");
-    if (f_file == NULL)
-    {
-        /* Failed to open file. */
-        printf("[!] Cannot access file '%s'\r\n", psz_filename);
-    }
-    else
+    /* Map file content. */
+    if (load_firmware(psz_filename) == 0)
     {
-        /* Set file cursor to the end. */
-        fseek(f_file, 0, SEEK_END);
-
-        /* Get file size. */
-        g_content_size = ftell(f_file);
-
-	/* Determine chunk size. */
-	compute_chunk_size();
+        /* File size must be at least the size of the target architecture's pointer size. */
+        if (g_content_size < get_arch_pointer_size(g_target_arch))
+        {
+            printf("[!] Input file must be at least %d bytes.\r\n", get_arch_pointer_size(g_target_arch));
+            unload_firmware();
+            return;
+        }
 
-        /* Go back to the beginning of this file. */
-        fseek(f_file, 0, SEEK_SET);
+        /* Step 0 - Analyze entropy. */
+        memory_analyze(gp_content, g_content_size, "default");
 
-        /* Allocate enough memory to store content. */
-        gp_content = (unsigned char *)malloc(g_content_size);
-        if (gp_content == NULL)
+        /* Guess the architecture (and endianness, if unknown). */
+        if (g_auto_arch)
         {
-            printf("[!] Cannot allocate memory for file %s (%d bytes is too large)\r\n", psz_filename, g_content_size);
+            endian = detect_endianness(&g_ptr_base, &g_ptr_mask);
+            if (g_target_endian == ENDIAN_UNKNOWN)
+            {
+                g_target_endian = endian;
+                printf("[i] Endianness is %s\r\n", (g_target_endian==ENDIAN_LE)?"LE":"BE");
+            }
         }
-        else
+
+        /* Decode pointers once for all the analysis steps. */
+        if (decode_pointers() < 0)
         {
-            /* Read file content. */
-            fread(gp_content, g_content_size, 1, f_file);
+            unload_firmware();
+            return;
+        }
 
-            /* Step 0 - Analyze entropy. */
-            memory_analyze(gp_content, g_content_size, "default");
-            
-            /* Step 1 - Index strings. */
-            index_poi_strings(&p_strings_list, STR_MIN_SIZE);
+        /* Step 1 - Index strings. */
+        index_poi_strings(&p_strings_list, STR_MIN_SIZE);
 
-            /* Step 2 - Index pointers. */
-            index_poi_pointers(&p_pointers_list, u64_base_address);
+        /* Step 2 - Index pointers. */
+        index_poi_pointers(&p_pointers_list, u64_base_address);
 
-            /* Step 3 - Filter out pointers that point to strings. */
-            next = &p_pointers_list;
-            while (next != NULL)
-            {
-                value = read_pointer(g_target_arch, g_target_endian, gp_content, next->offset);
+        /* Step 3 - Filter out pointers that point to strings. */
+        next = &p_pointers_list;
+        while (next != NULL)
+        {
+            value = read_target_pointer(next->offset);
 
-                /* Check if the pointed value is in our strings PoIs. */
-                next2 = &p_strings_list;
-                while (next2 != NULL)
+            /* Check if the pointed value is in our strings PoIs. */
+            next2 = &p_strings_list;
+            while (next2 != NULL)
+            {
+                if (value == (next2->offset + u64_base_address))
                 {
-                    if (value == (next2->offset + u64_base_address))
-                    {
-                        /* Mark this POI as a pointer to a string. */
-                        //printf("%016lx points to '%s'\n", next->offset + base_address, p_file_content + next2->offset);
-                        next->type = POI_STRING_POINTER;
-                        break;
-                    }
-
-                    next2 = next2->p_next;
+                    /* Mark this POI as a pointer to a string. */
+                    //printf("%016lx points to '%s'\n", next->offset + base_address, p_file_content + next2->offset);
+                    next->type = (next2->type == POI_WSTRING)?POI_WSTRING_POINTER:POI_STRING_POINTER;
+                    break;
                 }
-                next = next->p_next;
+
+                next2 = next2->p_next;
             }
+            next = next->p_next;
+        }
 
-            /* Step 4 - Filter out pointers that point to functions, data and uninitialized data. */
-            next = &p_pointers_list;
-            while (next != NULL)
+        /* Step 4 - Filter out pointers that point to functions, data and uninitialized data. */
+        next = &p_pointers_list;
+        while (next != NULL)
+        {
+            if (next->type >= POI_GENERIC_POINTER)
             {
-                if (next->type >= POI_GENERIC_POINTER)
-                {
-                    /* Check if we can have a valid function. */
-                    value = read_pointer(g_target_arch, g_target_endian, gp_content, next->offset);
-                    mem_type = memory_get_type(value - u64_base_address);
+                /* Check if we can have a valid function. */
+                value = read_target_pointer(next->offset);
+                mem_type = memory_get_type(value - u64_base_address);
 
-                    switch(mem_type)
-                    {
-                        case REGION_CODE:
-                            {
-                                next->type = POI_FUNCTION_POINTER;
-                            }
-                            break;
+                switch(mem_type)
+                {
+                    case REGION_CODE:
+                        {
+                            next->type = POI_FUNCTION_POINTER;
+                        }
+                        break;
 
-                        case REGION_INIT_DATA:
-                            {
-                                /* This pointer points to some data. */
-                                next->type = POI_DATA_POINTER;
-                            }
-                            break;
+                    case REGION_INIT_DATA:
+                        {
+                            /* This pointer points to some data. */
+                            next->type = POI_DATA_POINTER;
+                        }
+                        break;
 
-                        case REGION_UNINIT_DATA:
-                            {
-                                /* This pointer points to some uninitialized data. */
-                                next->type = POI_UNINIT_DATA_POINTER;
-                            }
-                            break;
+                    case REGION_UNINIT_DATA:
+                        {
+                            /* This pointer points to some uninitialized data. */
+                            next->type = POI_UNINIT_DATA_POINTER;
+                        }
+                        break;
 
-                        default:
-                            break;
-                    }
+                    default:
+                        break;
                 }
-
-                next = next->p_next;
             }
 
-            /* Loop for arrays of pointers of same type. */
-            index_poi_pointer_arrays(
-                &p_pointer_arrays_list,
-                &p_pointers_list,
-                u64_base_address
-            );
+            next = next->p_next;
+        }
 
-            /* Add various pointers. */
-            next = p_pointers_list.p_next;
-            while (next != NULL)
-            {
-                poi_add_unique_sorted(&p_sorted_pointers, next);
-                next = next->p_next;
-            }
+        /* Loop for arrays of pointers of same type. */
+        index_poi_pointer_arrays(
+            &p_pointer_arrays_list,
+            &p_pointers_list,
+            u64_base_address
+        );
 
-            /* Add pointers to arrays. */
-            next = p_pointer_arrays_list.p_next;
-            while (next != NULL)
-            {
-                poi_add_unique_sorted(&p_sorted_pointers, next);
-                next = next->p_next;
-            }           
+        /* Add various pointers. */
+        next = p_pointers_list.p_next;
+        while (next != NULL)
+        {
+            poi_add_unique_sorted(&p_sorted_pointers, next);
+            next = next->p_next;
+        }
+
+        /* Add pointers to arrays. */
+        next = p_pointer_arrays_list.p_next;
+        while (next != NULL)
+        {
+            poi_add_unique_sorted(&p_sorted_pointers, next);
+            next = next->p_next;
+        }           
 
-            /* Step 6 - Index structures arrays. */
+        /* Step 6 - Index structures arrays. */
+        if (g_struct_members > 0)
+        {
+            index_poi_structure_arrays_autocorr(
+                &p_structs_list,
+                &p_sorted_pointers,
+                &p_strings_list,
+                u64_base_address,
+                g_struct_members
+            );
+        }
+        else
+        {
             index_poi_structure_arrays(
                 &p_structs_list,
                 &p_sorted_pointers,
                 &p_strings_list,
                 u64_base_address
             );
-
-            /* Step 7 - Look for UDS database \o/ */
-            identify_uds(&p_structs_list, u64_base_address);
         }
+
+        /* Step 7 - Look for UDS (and other diagnostic protocols) database \o/ */
+        identify_diag_db(&p_structs_list, u64_base_address);
+
+        unload_firmware();
     }
 }
 
@@ -1909,10 +3442,18 @@ void print_usage(char *program_name)
     printf("Quarkslab's Binbloom - Raw firmware analysis tool - version %d.%d.%d\n\n", VER_MAJOR, VER_MINOR, VER_REV);
     printf("Binbloom searches for endianness, base addresses and UDS structures from raw firmware files.\n\n");
     printf(" Usage: %s [options] firmware_file\n", program_name);
-    printf("\t-a (--arch)\t\tSpecify target architecture, must be 32 or 64 (default: 32).\n");
+    printf("\t-a (--arch)\t\tSpecify target architecture, must be 16, 24, 32, 64 or auto (default: 32).\n");
     printf("\t-b (--base)\t\tSpecify base address to use for UDS structures search (optional).\n");
+    printf("\t-B (--budget)\t\tUse at most N strings to find the base address, the longest and unique ones (optional).\n");
     printf("\t-e (--endian)\t\tSpecify the endianness of the provided file, must be 'le' (little endian) or 'be' (big endian) (optional).\n");
+    printf("\t-S (--sample)\t\tGuess endianness from blocks sampled across the file (faster on large files).\n");
+    printf("\t-H (--hugepages)\tMap the firmware file with huge pages, if available (large files).\n");
     printf("\t-m (--align)\t\tSpecify base address alignment (default: 0x1000).\n");
+    printf("\t-s (--struct-members)\tSearch UDS structures with up to N members using autocorrelation (optional).\n");
+    printf("\t-p (--protocols)\tDiagnostic protocols to search, comma-separated: uds, kwp2000, obd2, xcp or all (default: uds).\n");
+    printf("\t-P (--protocols-file)\tLoad diagnostic protocols service IDs from a file (optional).\n");
+    printf("\t-n (--top)\t\tNumber of diagnostic database candidates to report per protocol (default: 1, 10 with -u).\n");
+    printf("\t-u (--scan)\t\tScan raw memory for diagnostic databases, without structure search (base address optional).\n");
     printf("\t-d (--deep)\t\tEnable deep search (very slow)\n");
     printf("\t-t (--threads)\t\tNumber of threads to use (default: 1)\n");
     printf("\t-v (--verbose)\t\tEnable verbose mode.\n");
@@ -1921,10 +3462,14 @@ void print_usage(char *program_name)
     printf("Examples:\n\n");
     printf("- Find the endianness and possible base address for an unknown 32-bit architecture firmware:\n");
     printf("\t%s -a 32 test_firmware.bin\n\n", program_name);
+    printf("- Guess both the architecture and the endianness:\n");
+    printf("\t%s -a auto test_firmware.bin\n\n", program_name);
     printf("- Find the base address knowing the endianness:\n");
     printf("\t%s -a 32 -e le test_firmware.bin\n\n", program_name);
     printf("- Find possible UDS database knowing the base address:\n");
-    printf("\t%s -a 32 -e le -b 0x1000 test_firmware.bin\n", program_name);
+    printf("\t%s -a 32 -e le -b 0x1000 test_firmware.bin\n\n", program_name);
+    printf("- Quickly scan for possible UDS and KWP2000 databases, without base address:\n");
+    printf("\t%s -u -p uds,kwp2000 test_firmware.bin\n", program_name);
 }
 
 
@@ -1970,6 +3515,30 @@ int main(int argc, char **argv)
         {
             "threads", required_argument, 0, 't'
         },
+        {
+            "struct-members", required_argument, 0, 's'
+        },
+        {
+            "protocols", required_argument, 0, 'p'
+        },
+        {
+            "protocols-file", required_argument, 0, 'P'
+        },
+        {
+            "scan", no_argument, 0, 'u'
+        },
+        {
+            "top", required_argument, 0, 'n'
+        },
+        {
+            "sample", no_argument, 0, 'S'
+        },
+        {
+            "budget", required_argument, 0, 'B'
+        },
+        {
+            "hugepages", no_argument, 0, 'H'
+        },
         {
             "help", no_argument, 0, 'h'
         },
@@ -1980,7 +3549,7 @@ int main(int argc, char **argv)
 
     while (1)
     {
-        opt = getopt_long(argc, argv, "a:b:m:e:t:f:vdh", long_options, &option_index);
+        opt = getopt_long(argc, argv, "a:b:m:e:t:f:s:p:P:n:B:uSHvdh", long_options, &option_index);
         if (opt == -1)
             break;
 
@@ -1988,20 +3557,39 @@ int main(int argc, char **argv)
         {
             case 'a':
                 {
-                    /* Processed argument. Arch must be '32' or '64'. */
-                    if (!strncmp(optarg, "32", 3))
+                    /* Processed argument. Arch must be '16', '24', '32', '64' or 'auto'. */
+                    if (!strncmp(optarg, "auto", 5))
+                    {
+                        g_auto_arch = 1;
+                        printf("[i] Architecture will be guessed.\n");
+                    }
+                    else if (!strncmp(optarg, "16", 3))
+                    {
+                        g_auto_arch = 0;
+                        g_target_arch = ARCH_16;
+                        printf("[i] 16-bit architecture selected.\n");
+                    }
+                    else if (!strncmp(optarg, "24", 3))
+                    {
+                        g_auto_arch = 0;
+                        g_target_arch = ARCH_24;
+                        printf("[i] 24-bit architecture selected.\n");
+                    }
+                    else if (!strncmp(optarg, "32", 3))
                     {
+                        g_auto_arch = 0;
                         g_target_arch = ARCH_32;
                         printf("[i] 32-bit architecture selected.\n");
                     }
                     else if (!strncmp(optarg, "64", 3))
                     {
+                        g_auto_arch = 0;
                         g_target_arch = ARCH_64;
                         printf("[i] 64-bit architecture selected.\n");
                     }
                     else
                     {
-                        warning("-a option (arch) must be '32' or '64', considering 32-bit architecture.\n");
+                        warning("-a option (arch) must be '16', '24', '32', '64' or 'auto', considering 32-bit architecture.\n");
                     }
                 }
                 break;
@@ -2036,6 +3624,23 @@ int main(int argc, char **argv)
                 }
                 break;
 
+            case 's':
+                {
+                    /* Maximum number of members, enables autocorrelation-based structure search. */
+                    g_struct_members = atoi(optarg);
+                    if (g_struct_members < 2)
+                    {
+                        warning("-s option (struct-members) must be at least 2, using default structure search.\n");
+                        g_struct_members = 0;
+                    }
+                    else if (g_struct_members > MAX_STRUCT_MEMBERS_AUTOCORR)
+                    {
+                        warning("-s option (struct-members) cannot exceed %d, using %d.\n", MAX_STRUCT_MEMBERS_AUTOCORR, MAX_STRUCT_MEMBERS_AUTOCORR);
+                        g_struct_members = MAX_STRUCT_MEMBERS_AUTOCORR;
+                    }
+                }
+                break;
+
             case 'e':
                 {
                     /* Process endianness. Expect 'le' or 'be' as parameter. */
@@ -2063,6 +3668,58 @@ int main(int argc, char **argv)
                 }
                 break;
 
+            case 'p':
+                {
+                    psz_protocols = optarg;
+                }
+                break;
+
+            case 'P':
+                {
+                    psz_protocols_file = optarg;
+                }
+                break;
+
+            case 'n':
+                {
+                    g_top_candidates = atoi(optarg);
+                    if (g_top_candidates < 1)
+                    {
+                        warning("-n option (top) must be at least 1, using default number of candidates.\n");
+                        g_top_candidates = 0;
+                    }
+                }
+                break;
+
+            case 'B':
+                {
+                    g_poi_budget = atoi(optarg);
+                    if (g_poi_budget < 1)
+                    {
+                        warning("-B option (budget) must be at least 1, keeping all strings.\n");
+                        g_poi_budget = 0;
+                    }
+                }
+                break;
+
+            case 'u':
+                {
+                    g_direct_scan = 1;
+                }
+                break;
+
+            case 'S':
+                {
+                    g_sample = 1;
+                }
+                break;
+
+            case 'H':
+                {
+                    g_hugepages = 1;
+                }
+                break;
+
             case 'v':
                 {
                     g_verbose++;
@@ -2130,12 +3787,42 @@ int main(int argc, char **argv)
             {
                 g_symbols_list = poi_list();
                 read_poi_from_file(psz_functions_file, g_symbols_list);
+
+                /* Index functions, before other PoIs are added to this list. */
+                gp_symbols_index = poi_index_create(g_symbols_list);
+                if (gp_symbols_index == NULL)
+                {
+                    error("Cannot allocate memory for symbols index.\n");
+                    return -1;
+                }
             }
 
-            if (base_address != DEFAULT_BASE_ADDRESS)
+            if (g_direct_scan || (base_address != DEFAULT_BASE_ADDRESS))
             {
-                /* Search coherent data. */
-                find_coherent_data(psz_firmware_path, base_address);
+                /* Register diagnostic protocols to search. */
+                diag_init();
+                if (psz_protocols_file != NULL)
+                    diag_load_file(psz_protocols_file);
+                if ((psz_protocols != NULL) && (diag_select(psz_protocols) == 0))
+                {
+                    error("No diagnostic protocol selected.\n");
+                    return -1;
+                }
+
+                if (g_direct_scan)
+                {
+                    /* Scan raw memory for diagnostic databases. */
+                    if (load_firmware(psz_firmware_path) < 0)
+                        return -1;
+                    printf("[i] File read (%lu bytes)\r\n", g_content_size);
+                    scan_diag_db((base_address != DEFAULT_BASE_ADDRESS)?base_address:0);
+                    unload_firmware();
+                }
+                else
+                {
+                    /* Search coherent data. */
+                    find_coherent_data(psz_firmware_path, base_address);
+                }
             }
             else
                 find_base_address(psz_firmware_path);
@@ -0,0 +1,70 @@
+#include "bitmap.h"
+
+/**
+ * @brief   Allocate a bitmap with all bits cleared
+ * @param   nb_bits     number of bits
+ * @return  pointer to newly allocated bitmap, or NULL on error
+ **/
+
+bitmap_t *bitmap_alloc(uint64_t nb_bits)
+{
+    bitmap_t *p_bitmap;
+
+    p_bitmap = (bitmap_t *)malloc(sizeof(bitmap_t));
+    if (p_bitmap != NULL)
+    {
+        p_bitmap->nb_bits = nb_bits;
+        p_bitmap->nb_words = (nb_bits + 63)/64;
+
+        /* Allocate one more word so that word-wise readers never go out of bounds. */
+        p_bitmap->p_words = (uint64_t *)calloc(p_bitmap->nb_words + 1, sizeof(uint64_t));
+        if (p_bitmap->p_words == NULL)
+        {
+            free(p_bitmap);
+            return NULL;
+        }
+    }
+
+    return p_bitmap;
+}
+
+
+/**
+ * @brief   Free a bitmap
+ * @param   p_bitmap    pointer to the bitmap to free
+ **/
+
+void bitmap_free(bitmap_t *p_bitmap)
+{
+    if (p_bitmap != NULL)
+    {
+        free(p_bitmap->p_words);
+        free(p_bitmap);
+    }
+}
+
+
+/**
+ * @brief   Compute the autocorrelation of a bitmap for a given lag
+ *
+ * Counts the number of bits `i` such that both bit `i` and bit `i+lag` are
+ * set, processing 64 bits at a time (AND of the bitmap with a shifted copy
+ * of itself, followed by a population count).
+ *
+ * @param   p_bitmap    pointer to a bitmap
+ * @param   lag         lag (in bits)
+ * @return  number of set bits having a set bit `lag` bits further
+ **/
+
+uint64_t bitmap_autocorrelation(bitmap_t *p_bitmap, uint64_t lag)
+{
+    uint64_t w, count = 0;
+
+    for (w=0; w<p_bitmap->nb_words; w++)
+    {
+        if (p_bitmap->p_words[w] != 0)
+            count += __builtin_popcountll(p_bitmap->p_words[w] & bitmap_get_word_at(p_bitmap, w*64 + lag));
+    }
+
+    return count;
+}
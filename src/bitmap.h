@@ -0,0 +1,73 @@
+/**
+ * Bitmap
+ *
+ * Simple fixed-size bitmap used to index offsets of points of interest. Each
+ * bit represents a slot (usually a pointer-sized word of the firmware), so
+ * checking whether a slot is used costs a single bit test instead of a walk
+ * through a list of POIs.
+ **/
+
+#pragma once
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+typedef struct {
+    uint64_t *p_words;
+    uint64_t nb_bits;
+    uint64_t nb_words;
+} bitmap_t;
+
+bitmap_t *bitmap_alloc(uint64_t nb_bits);
+void bitmap_free(bitmap_t *p_bitmap);
+uint64_t bitmap_autocorrelation(bitmap_t *p_bitmap, uint64_t lag);
+
+
+/**
+ * @brief   Set a bit in a bitmap
+ * @param   p_bitmap    pointer to a bitmap
+ * @param   bit         index of the bit to set
+ **/
+
+static inline void bitmap_set(bitmap_t *p_bitmap, uint64_t bit)
+{
+    p_bitmap->p_words[bit >> 6] |= (1ULL << (bit & 63));
+}
+
+
+/**
+ * @brief   Test a bit in a bitmap
+ * @param   p_bitmap    pointer to a bitmap
+ * @param   bit         index of the bit to test
+ * @return  1 if bit is set, 0 otherwise (or if bit is out of range)
+ **/
+
+static inline int bitmap_test(bitmap_t *p_bitmap, uint64_t bit)
+{
+    if (bit >= p_bitmap->nb_bits)
+        return 0;
+    return (p_bitmap->p_words[bit >> 6] >> (bit & 63)) & 1;
+}
+
+
+/**
+ * @brief   Read 64 consecutive bits of a bitmap starting at any bit index
+ * @param   p_bitmap    pointer to a bitmap
+ * @param   bit         index of the first bit to read
+ * @return  bits `bit` to `bit+63` (bit `bit` as LSB), bits out of range read as 0
+ **/
+
+static inline uint64_t bitmap_get_word_at(bitmap_t *p_bitmap, uint64_t bit)
+{
+    uint64_t q = bit >> 6;
+    unsigned int r = bit & 63;
+    uint64_t lo, hi;
+
+    lo = (q < p_bitmap->nb_words)?p_bitmap->p_words[q]:0;
+    if (r == 0)
+        return lo;
+    hi = ((q + 1) < p_bitmap->nb_words)?p_bitmap->p_words[q + 1]:0;
+
+    return (lo >> r) | (hi << (64 - r));
+}
@@ -4,10 +4,26 @@
 #define MAX_MEM_AMOUNT 4000000000
 #define DEFAULT_BASE_ADDRESS 0xffffffffffffffff
 #define MAX_STRUCT_MEMBERS 12
+#define MAX_STRUCT_MEMBERS_AUTOCORR 256
+
+/* Sampling-based endianness detection. */
+#define SAMPLE_BLOCK_SIZE 0x1000
+#define SAMPLE_MIN_BLOCKS 16
+#define SAMPLE_ROUND_BLOCKS 16
+#define SAMPLE_Z_SCORE 3.29
+
+/* Array search (number of values processed at once, minimum number of values per thread). */
+#define ARRAYS_BLOCK_SIZE 4096
+#define ARRAYS_MIN_THREAD_VALUES 0x10000
+
+/* Automatic pointer width detection (minimum ratio of 32-bit to 64-bit votes). */
+#define ARCH_AUTO_RATIO 10
 
 typedef enum {
     ARCH_32,
     ARCH_64,
+    ARCH_16,
+    ARCH_24,
 } arch_t;
 
 typedef enum {
@@ -0,0 +1,620 @@
+#include <stdio.h>
+#include <strings.h>
+
+#include "diag.h"
+#include "log.h"
+
+/**
+ * List of built-in diagnostic protocols, using the same format as protocol
+ * files. Only UDS is searched by default.
+ **/
+
+static char *g_diag_builtins[] = {
+    /* ISO 14229 Unified Diagnostic Services. */
+    "UDS 0x10 0x11 0x14 0x19 0x22-0x24 0x27-0x2A 0x2C 0x2E 0x2F 0x31 0x34-0x38 0x3E 0x83-0x87",
+
+    /* ISO 14230 Keyword Protocol 2000. */
+    "KWP2000 0x10-0x14 0x17 0x18 0x1A 0x20-0x23 0x26 0x27 0x2C 0x2E-0x3B 0x3D 0x3E 0x81-0x83 0x85",
+
+    /* SAE J1979 OBD-II modes. */
+    "OBD2 0x01-0x0A",
+
+    /* ASAM XCP command codes. */
+    "XCP 0xC0-0xFF",
+
+    /* End of built-in protocols. */
+    NULL
+};
+
+static diag_protocol_t g_protocols[DIAG_MAX_PROTOCOLS];
+static int g_nb_protocols = 0;
+
+
+/**
+ * @brief   Parse a service ID (hex, with or without 0x prefix)
+ * @param   psz_value   text to parse
+ * @return  service ID on success, -1 otherwise
+ **/
+
+static int diag_parse_sid(char *psz_value)
+{
+    char *psz_end;
+    long value;
+
+    if (*psz_value == '\0')
+        return -1;
+
+    value = strtol(psz_value, &psz_end, 16);
+    if ((*psz_end != '\0') || (value < 0) || (value > 0xff))
+        return -1;
+
+    return (int)value;
+}
+
+
+/**
+ * @brief   Parse a protocol definition line
+ * @param   psz_line    line to parse (modified)
+ * @param   p_protocol  pointer to a diagnostic protocol (output)
+ * @return  0 on success, 1 if line is empty or a comment, -1 on error
+ **/
+
+static int diag_parse_line(char *psz_line, diag_protocol_t *p_protocol)
+{
+    char *psz_token, *psz_saveptr, *psz_dash;
+    int first, last, value;
+
+    /* Get protocol name, skip empty lines and comments. */
+    psz_token = strtok_r(psz_line, " \t,\r\n", &psz_saveptr);
+    if ((psz_token == NULL) || (psz_token[0] == '#'))
+        return 1;
+
+    memset(p_protocol, 0, sizeof(diag_protocol_t));
+    strncpy(p_protocol->psz_name, psz_token, DIAG_NAME_SIZE - 1);
+
+    /* Parse service IDs and ranges of service IDs. */
+    while ((psz_token = strtok_r(NULL, " \t,\r\n", &psz_saveptr)) != NULL)
+    {
+        if (psz_token[0] == '#')
+            break;
+
+        psz_dash = strchr(psz_token, '-');
+        if (psz_dash != NULL)
+        {
+            *psz_dash = '\0';
+            first = diag_parse_sid(psz_token);
+            last = diag_parse_sid(psz_dash + 1);
+        }
+        else
+        {
+            first = diag_parse_sid(psz_token);
+            last = first;
+        }
+
+        if ((first < 0) || (last < first))
+            return -1;
+
+        for (value=first; value<=last; value++)
+            p_protocol->sids[value >> 6] |= (1ULL << (value & 63));
+    }
+
+    return 0;
+}
+
+
+/**
+ * @brief   Register a diagnostic protocol, replacing any protocol with the same name
+ * @param   p_protocol  pointer to the diagnostic protocol to register
+ * @return  0 on success, -1 if there are too many protocols
+ **/
+
+static int diag_register(diag_protocol_t *p_protocol)
+{
+    int i;
+
+    for (i=0; i<g_nb_protocols; i++)
+    {
+        if (!strcasecmp(g_protocols[i].psz_name, p_protocol->psz_name))
+        {
+            memcpy(&g_protocols[i], p_protocol, sizeof(diag_protocol_t));
+            return 0;
+        }
+    }
+
+    if (g_nb_protocols >= DIAG_MAX_PROTOCOLS)
+        return -1;
+
+    memcpy(&g_protocols[g_nb_protocols++], p_protocol, sizeof(diag_protocol_t));
+    return 0;
+}
+
+
+/**
+ * @brief   Register built-in diagnostic protocols (only UDS is enabled)
+ * @return  0 on success, -1 otherwise
+ **/
+
+int diag_init(void)
+{
+    int i;
+    char line[256];
+    diag_protocol_t protocol;
+
+    g_nb_protocols = 0;
+    for (i=0; g_diag_builtins[i] != NULL; i++)
+    {
+        strncpy(line, g_diag_builtins[i], sizeof(line) - 1);
+        line[sizeof(line) - 1] = '\0';
+        if ((diag_parse_line(line, &protocol) != 0) || (diag_register(&protocol) < 0))
+            return -1;
+    }
+    g_protocols[0].enabled = 1;
+
+    return 0;
+}
+
+
+/**
+ * @brief   Load diagnostic protocols from a file (loaded protocols are enabled)
+ * @param   psz_file    path to protocols file
+ * @return  number of protocols loaded on success, -1 otherwise
+ **/
+
+int diag_load_file(char *psz_file)
+{
+    FILE *f_file;
+    char line[4096];
+    diag_protocol_t protocol;
+    int ret, line_number = 0, nb_loaded = 0;
+
+    f_file = fopen(psz_file, "r");
+    if (f_file == NULL)
+    {
+        error("Cannot access protocols file '%s'\n", psz_file);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), f_file) != NULL)
+    {
+        line_number++;
+        ret = diag_parse_line(line, &protocol);
+        if (ret < 0)
+        {
+            warning("Invalid service ID in protocols file '%s' (line %d), skipped.\n", psz_file, line_number);
+        }
+        else if (ret == 0)
+        {
+            protocol.enabled = 1;
+            if (diag_register(&protocol) < 0)
+            {
+                warning("Too many protocols, '%s' ignored.\n", protocol.psz_name);
+            }
+            else
+            {
+                debug("Loaded protocol %s\n", protocol.psz_name);
+                nb_loaded++;
+            }
+        }
+    }
+
+    fclose(f_file);
+    return nb_loaded;
+}
+
+
+/**
+ * @brief   Select protocols to search
+ * @param   psz_names   comma-separated list of protocol names, or "all"
+ * @return  number of enabled protocols
+ **/
+
+int diag_select(char *psz_names)
+{
+    char names[1024];
+    char *psz_token, *psz_saveptr;
+    int i, found;
+
+    for (i=0; i<g_nb_protocols; i++)
+        g_protocols[i].enabled = 0;
+
+    strncpy(names, psz_names, sizeof(names) - 1);
+    names[sizeof(names) - 1] = '\0';
+    psz_token = strtok_r(names, ",", &psz_saveptr);
+    while (psz_token != NULL)
+    {
+        found = 0;
+        for (i=0; i<g_nb_protocols; i++)
+        {
+            if (!strcasecmp(psz_token, "all") || !strcasecmp(psz_token, g_protocols[i].psz_name))
+            {
+                g_protocols[i].enabled = 1;
+                found = 1;
+            }
+        }
+        if (!found)
+            warning("Unknown protocol '%s', ignored.\n", psz_token);
+
+        psz_token = strtok_r(NULL, ",", &psz_saveptr);
+    }
+
+    return diag_count_enabled();
+}
+
+
+/**
+ * @brief   Get the number of registered protocols
+ * @return  number of protocols
+ **/
+
+int diag_count(void)
+{
+    return g_nb_protocols;
+}
+
+
+/**
+ * @brief   Get the number of enabled protocols
+ * @return  number of enabled protocols
+ **/
+
+int diag_count_enabled(void)
+{
+    int i, count = 0;
+
+    for (i=0; i<g_nb_protocols; i++)
+    {
+        if (g_protocols[i].enabled)
+            count++;
+    }
+
+    return count;
+}
+
+
+/**
+ * @brief   Get a registered protocol
+ * @param   index   protocol index
+ * @return  pointer to the protocol, or NULL if index is out of range
+ **/
+
+diag_protocol_t *diag_get(int index)
+{
+    if ((index < 0) || (index >= g_nb_protocols))
+        return NULL;
+
+    return &g_protocols[index];
+}
+
+
+/**
+ * @brief   Find the longest run of unique valid service IDs in a column of bytes
+ * @param   p_column    pointer to the column bytes
+ * @param   count       number of bytes in column
+ * @param   p_protocol  pointer to the diagnostic protocol to consider
+ * @param   p_start     index of the first item of the longest run (output)
+ * @return  size of the longest run
+ **/
+
+int diag_longest_unique_run(uint8_t *p_column, uint64_t count, diag_protocol_t *p_protocol, uint64_t *p_start)
+{
+    uint64_t k, run_start;
+    int best_size = 0;
+    int64_t last_seen[256];
+
+    /* Sliding window: a run is broken by an invalid ID and shrunk on a duplicate. */
+    for (k=0; k<256; k++)
+        last_seen[k] = -1;
+    run_start = 0;
+    *p_start = 0;
+    for (k=0; k<count; k++)
+    {
+        if (!diag_is_valid_sid(p_protocol, p_column[k]))
+        {
+            run_start = k + 1;
+            continue;
+        }
+
+        if (last_seen[p_column[k]] >= (int64_t)run_start)
+            run_start = last_seen[p_column[k]] + 1;
+        last_seen[p_column[k]] = k;
+
+        if ((k - run_start + 1) > (uint64_t)best_size)
+        {
+            best_size = (int)(k - run_start + 1);
+            *p_start = run_start;
+        }
+    }
+
+    return best_size;
+}
+
+
+/**
+ * @brief   Check if a candidate is better than another one
+ *
+ * Candidates with more unique service IDs are better. On a tie, the candidate
+ * found in the first array of structures wins.
+ *
+ * @param   p_a     pointer to the first candidate
+ * @param   p_b     pointer to the second candidate
+ * @return  1 if `p_a` is better than `p_b`, 0 otherwise
+ **/
+
+static int diag_candidate_better(diag_candidate_t *p_a, diag_candidate_t *p_b)
+{
+    return (p_a->size > p_b->size) || ((p_a->size == p_b->size) && (p_a->index < p_b->index));
+}
+
+
+/**
+ * @brief   Restore the heap property from a given item down to the leaves
+ * @param   p_heap  pointer to a candidates heap
+ * @param   i       index of the item to sift down
+ **/
+
+static void diag_heap_sift_down(diag_heap_t *p_heap, int i)
+{
+    diag_candidate_t tmp;
+    int child;
+
+    while ((child = 2*i + 1) < p_heap->count)
+    {
+        /* Select the worst child. */
+        if (((child + 1) < p_heap->count) && diag_candidate_better(&p_heap->p_items[child], &p_heap->p_items[child + 1]))
+            child++;
+
+        if (!diag_candidate_better(&p_heap->p_items[i], &p_heap->p_items[child]))
+            break;
+
+        tmp = p_heap->p_items[i];
+        p_heap->p_items[i] = p_heap->p_items[child];
+        p_heap->p_items[child] = tmp;
+        i = child;
+    }
+}
+
+
+/**
+ * @brief   Initialize a heap keeping at most `max_count` candidates
+ * @param   p_heap      pointer to a candidates heap
+ * @param   max_count   maximum number of candidates to keep
+ * @return  0 on success, -1 on error
+ **/
+
+int diag_heap_init(diag_heap_t *p_heap, int max_count)
+{
+    p_heap->count = 0;
+    p_heap->max_count = max_count;
+    p_heap->p_items = (diag_candidate_t *)malloc(sizeof(diag_candidate_t) * max_count);
+
+    return (p_heap->p_items == NULL)?-1:0;
+}
+
+
+/**
+ * @brief   Add a candidate to a heap, if it is one of the best candidates
+ *
+ * The worst kept candidate sits at the root of the heap, so that a new
+ * candidate is either rejected in O(1) or replaces it in O(log N).
+ *
+ * @param   p_heap      pointer to a candidates heap
+ * @param   p_candidate pointer to the candidate to add (copied)
+ **/
+
+void diag_heap_push(diag_heap_t *p_heap, diag_candidate_t *p_candidate)
+{
+    diag_candidate_t tmp;
+    int i, parent;
+
+    if (p_heap->count < p_heap->max_count)
+    {
+        /* Heap is not full, sift new candidate up. */
+        i = p_heap->count++;
+        p_heap->p_items[i] = *p_candidate;
+        while (i > 0)
+        {
+            parent = (i - 1)/2;
+            if (!diag_candidate_better(&p_heap->p_items[parent], &p_heap->p_items[i]))
+                break;
+            tmp = p_heap->p_items[i];
+            p_heap->p_items[i] = p_heap->p_items[parent];
+            p_heap->p_items[parent] = tmp;
+            i = parent;
+        }
+    }
+    else if ((p_heap->max_count > 0) && diag_candidate_better(p_candidate, &p_heap->p_items[0]))
+    {
+        /* Replace the worst candidate. */
+        p_heap->p_items[0] = *p_candidate;
+        diag_heap_sift_down(p_heap, 0);
+    }
+}
+
+
+/**
+ * @brief   Sort the candidates of a heap, best candidate first
+ *
+ * The heap property is lost, no candidate must be added afterwards.
+ *
+ * @param   p_heap  pointer to a candidates heap
+ * @return  number of candidates
+ **/
+
+int diag_heap_sort(diag_heap_t *p_heap)
+{
+    diag_candidate_t tmp;
+    int count = p_heap->count;
+
+    /* Heap sort: move the worst candidate to the end, until the heap is empty. */
+    while (p_heap->count > 1)
+    {
+        tmp = p_heap->p_items[0];
+        p_heap->p_items[0] = p_heap->p_items[--p_heap->count];
+        p_heap->p_items[p_heap->count] = tmp;
+        diag_heap_sift_down(p_heap, 0);
+    }
+    p_heap->count = count;
+
+    return count;
+}
+
+
+/**
+ * @brief   Free a candidates heap
+ * @param   p_heap  pointer to a candidates heap
+ **/
+
+void diag_heap_free(diag_heap_t *p_heap)
+{
+    free(p_heap->p_items);
+    p_heap->p_items = NULL;
+    p_heap->count = 0;
+}
+
+
+/**
+ * @brief   Build a bitmap of the bytes that are valid service IDs
+ *
+ * Bit `i` of the returned bitmap is set if byte `i` of the provided data is a
+ * valid service ID for the given protocol. Bytes are processed 64 at a time
+ * without branches, one bitmap word per 64 bytes.
+ *
+ * @param   p_protocol  pointer to a diagnostic protocol
+ * @param   p_data      pointer to data to scan
+ * @param   size        data size
+ * @return  pointer to an allocated bitmap, or NULL on error
+ **/
+
+bitmap_t *diag_build_bitmap(diag_protocol_t *p_protocol, uint8_t *p_data, uint64_t size)
+{
+    bitmap_t *p_bitmap;
+    uint64_t w, bits;
+    int j;
+
+    p_bitmap = bitmap_alloc(size);
+    if (p_bitmap != NULL)
+    {
+        /* Full words. */
+        for (w=0; w<(size/64); w++)
+        {
+            bits = 0;
+            for (j=0; j<64; j++)
+                bits |= (uint64_t)diag_is_valid_sid(p_protocol, p_data[w*64 + j]) << j;
+            p_bitmap->p_words[w] = bits;
+        }
+
+        /* Remaining bytes. */
+        for (j=0; j<(int)(size%64); j++)
+        {
+            if (diag_is_valid_sid(p_protocol, p_data[w*64 + j]))
+                bitmap_set(p_bitmap, w*64 + j);
+        }
+    }
+
+    return p_bitmap;
+}
+
+
+/**
+ * @brief   Scan raw memory for diagnostic tables, without any structure information
+ *
+ * A diagnostic table is an array of entries of `stride` bytes in which one byte
+ * holds a service ID. With `V` the bitmap of valid service IDs, bit `i` of
+ * `V & V>>s & V>>2s & V>>3s` is set if bytes `i`, `i+s`, `i+2s` and `i+3s` are
+ * all valid, which is tested 64 byte columns at a time for every stride `s`.
+ * Only the resulting chains of valid bytes are walked, and the longest run of
+ * unique service IDs of each chain is recorded as a table.
+ *
+ * @param   protocol    index of the diagnostic protocol to search
+ * @param   p_data      pointer to data to scan
+ * @param   size        data size
+ * @param   pp_tables   pointer to an allocated array of tables (output, to be freed by caller)
+ * @return  number of tables found, -1 on error
+ **/
+
+int diag_scan_tables(int protocol, uint8_t *p_data, uint64_t size, diag_table_t **pp_tables)
+{
+    diag_protocol_t *p_protocol;
+    diag_table_t *p_tables = NULL, *p_realloc;
+    bitmap_t *p_valid_bitmap;
+    uint8_t *p_column = NULL;
+    uint64_t w, starts, bit, cursor, count, start, max_count;
+    int stride, k, run_size, nb_tables = 0, max_tables = 0;
+
+    *pp_tables = NULL;
+    p_protocol = diag_get(protocol);
+    if (p_protocol == NULL)
+        return -1;
+
+    /* One pass over memory: flag bytes that are valid service IDs. */
+    p_valid_bitmap = diag_build_bitmap(p_protocol, p_data, size);
+    if (p_valid_bitmap == NULL)
+        return -1;
+
+    /* A chain never holds more than size/DIAG_SCAN_MIN_STRIDE bytes. */
+    max_count = (size/DIAG_SCAN_MIN_STRIDE) + 1;
+    p_column = (uint8_t *)malloc(max_count);
+    if (p_column == NULL)
+        goto error;
+
+    for (stride=DIAG_SCAN_MIN_STRIDE; stride<=DIAG_SCAN_MAX_STRIDE; stride++)
+    {
+        for (w=0; w<p_valid_bitmap->nb_words; w++)
+        {
+            if (p_valid_bitmap->p_words[w] == 0)
+                continue;
+
+            /* Bytes followed by enough valid bytes at this stride. */
+            starts = p_valid_bitmap->p_words[w];
+            for (k=1; k<DIAG_SCAN_MIN_ENTRIES; k++)
+                starts &= bitmap_get_word_at(p_valid_bitmap, w*64 + (uint64_t)k*stride);
+
+            /* Keep chain starts only (byte `stride` bytes before is not valid). */
+            if (w*64 >= (uint64_t)stride)
+                starts &= ~bitmap_get_word_at(p_valid_bitmap, w*64 - stride);
+            else if ((stride - w*64) < 64)
+                starts &= ~(p_valid_bitmap->p_words[0] << (stride - w*64));
+
+            while (starts != 0)
+            {
+                bit = w*64 + __builtin_ctzll(starts);
+                starts &= starts - 1;
+
+                /* Gather this chain. */
+                count = 0;
+                for (cursor=bit; (cursor<size) && bitmap_test(p_valid_bitmap, cursor); cursor+=stride)
+                    p_column[count++] = p_data[cursor];
+
+                run_size = diag_longest_unique_run(p_column, count, p_protocol, &start);
+                if (run_size < DIAG_SCAN_MIN_ENTRIES)
+                    continue;
+
+                if (nb_tables >= max_tables)
+                {
+                    max_tables = (max_tables == 0)?256:(max_tables*2);
+                    p_realloc = (diag_table_t *)realloc(p_tables, sizeof(diag_table_t) * max_tables);
+                    if (p_realloc == NULL)
+                        goto error;
+                    p_tables = p_realloc;
+                }
+
+                p_tables[nb_tables].offset = bit + start*stride;
+                p_tables[nb_tables].stride = stride;
+                p_tables[nb_tables].size = run_size;
+                p_tables[nb_tables].protocol = protocol;
+                nb_tables++;
+            }
+        }
+    }
+
+    free(p_column);
+    bitmap_free(p_valid_bitmap);
+    *pp_tables = p_tables;
+    return nb_tables;
+
+error:
+    free(p_column);
+    free(p_tables);
+    bitmap_free(p_valid_bitmap);
+    return -1;
+}
@@ -0,0 +1,95 @@
+/**
+ * Diagnostic protocols
+ *
+ * Diagnostic databases (UDS, KWP2000, OBD-II, XCP, ...) are arrays of structures
+ * in which one member holds the service ID handled by each entry. Each protocol
+ * is described by the set of its valid service IDs, stored as a 256-bit bitset
+ * so that checking a byte is a single bit test.
+ *
+ * Protocols are either built-in or loaded from a text file, one protocol per
+ * line: a name followed by service IDs (hex) or ranges of service IDs, e.g.
+ *
+ *   # name   service IDs
+ *   UDS      0x10 0x11 0x14 0x19 0x22-0x24 0x27-0x29 0x3E
+ **/
+
+#pragma once
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "bitmap.h"
+#include "poi.h"
+
+/* Maximum number of protocols (built-in and loaded from file). */
+#define DIAG_MAX_PROTOCOLS  32
+
+/* Maximum size of a protocol name. */
+#define DIAG_NAME_SIZE      32
+
+/* Direct scan: strides (in bytes) and minimum number of entries of a table. */
+#define DIAG_SCAN_MIN_STRIDE    2
+#define DIAG_SCAN_MAX_STRIDE    128
+#define DIAG_SCAN_MIN_ENTRIES   4
+
+/* Direct scan: number of tables reported per protocol. */
+#define DIAG_SCAN_RESULTS       10
+
+/* Diagnostic protocol. */
+typedef struct {
+    char psz_name[DIAG_NAME_SIZE];
+    uint64_t sids[4];
+    int enabled;
+} diag_protocol_t;
+
+/* Diagnostic database candidate (best column of an array of structures). */
+typedef struct {
+    poi_t *p_struct;
+    uint64_t index;
+    int column;
+    uint64_t start;
+    int size;
+} diag_candidate_t;
+
+/* Bounded min-heap keeping the best diagnostic database candidates. */
+typedef struct {
+    diag_candidate_t *p_items;
+    int count;
+    int max_count;
+} diag_heap_t;
+
+/* Diagnostic table found by direct scan (no structure information). */
+typedef struct {
+    uint64_t offset;
+    int stride;
+    int size;
+    int protocol;
+} diag_table_t;
+
+int diag_init(void);
+int diag_load_file(char *psz_file);
+int diag_select(char *psz_names);
+int diag_count(void);
+int diag_count_enabled(void);
+diag_protocol_t *diag_get(int index);
+bitmap_t *diag_build_bitmap(diag_protocol_t *p_protocol, uint8_t *p_data, uint64_t size);
+int diag_longest_unique_run(uint8_t *p_column, uint64_t count, diag_protocol_t *p_protocol, uint64_t *p_start);
+int diag_heap_init(diag_heap_t *p_heap, int max_count);
+void diag_heap_push(diag_heap_t *p_heap, diag_candidate_t *p_candidate);
+int diag_heap_sort(diag_heap_t *p_heap);
+void diag_heap_free(diag_heap_t *p_heap);
+int diag_scan_tables(int protocol, uint8_t *p_data, uint64_t size, diag_table_t **pp_tables);
+
+
+/**
+ * @brief   Check if a byte is a valid service ID for a given protocol
+ * @param   p_protocol  pointer to a diagnostic protocol
+ * @param   value       byte to test
+ * @return  1 if valid, 0 otherwise
+ **/
+
+static inline int diag_is_valid_sid(diag_protocol_t *p_protocol, uint8_t value)
+{
+    return (p_protocol->sids[value >> 6] >> (value & 63)) & 1;
+}
@@ -1,125 +1,365 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
 #include "functions.h"
 
+/* Hexadecimal digit values, or -1 for other characters. */
+static const int8_t g_hex_digits[256] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+     0,  1,  2,  3,  4,  5,  6,  7,  8,  9, -1, -1, -1, -1, -1, -1,
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+};
+
+
 /**
- * @brief   Load a list of functions addresses from a file.
+ * @brief   Decode a field made of hexadecimal digits only
+ * @param   p_start     pointer to the first character of the field
+ * @param   p_end       pointer to the character following the field
+ * @param   p_value     pointer to the decoded value
+ * @return  1 if the field is a valid 64-bit hexadecimal value, 0 otherwise
+ **/
+
+static int decode_hex(const char *p_start, const char *p_end, uint64_t *p_value)
+{
+    uint64_t value = 0;
+    int digit;
+
+    /* Up to 16 digits. */
+    if ((p_start >= p_end) || ((p_end - p_start) > 16))
+        return 0;
+
+    while (p_start < p_end)
+    {
+        digit = g_hex_digits[(uint8_t)*p_start++];
+        if (digit < 0)
+            return 0;
+        value = (value << 4) | digit;
+    }
+
+    *p_value = value;
+    return 1;
+}
+
+
+/**
+ * @brief   Find the end of a field
+ * @param   p_start     pointer to the first character of the field
+ * @param   p_end       pointer to the end of the line
+ * @param   separator   field separator (spaces also end fields if ' ')
+ * @return  pointer to the character following the field
+ **/
+
+static const char *field_end(const char *p_start, const char *p_end, char separator)
+{
+    while ((p_start < p_end) && (*p_start != separator) && !((separator == ' ') && ((*p_start == '\t') || (*p_start == '\r'))))
+        p_start++;
+    return p_start;
+}
+
+
+/**
+ * @brief   Skip spaces
+ * @param   p_start     pointer to the first character
+ * @param   p_end       pointer to the end of the line
+ * @return  pointer to the first character that is not a space
+ **/
+
+static const char *skip_spaces(const char *p_start, const char *p_end)
+{
+    while ((p_start < p_end) && ((*p_start == ' ') || (*p_start == '\t') || (*p_start == '\r')))
+        p_start++;
+    return p_start;
+}
+
+
+/**
+ * @brief   Parse the address of a function from a line of a symbols file
  *
- * Read a list of point of interest from a file. Each line must follow this
- * pattern: <Address in hex> <POI name>
+ * Supported formats are:
+ *  - `0x<address> <name>`, the original format, that may also follow other
+ *    text on lines matching none of the formats below,
+ *  - `<address> <type> <name>`, as output by nm (text symbols only),
+ *  - `<name>\t<segment>\t<address>\t...`, as exported from the IDA functions window,
+ *  - `"<name>","<address>","Function",...`, as exported from the Ghidra symbol
+ *    table (the address may be prefixed by its address space).
  *
- * @param   psz_file        Path to file
- * @param   p_poi_list      pointer to a list of POI to fill
+ * @param   p_line      pointer to the first character of the line
+ * @param   p_end       pointer to the end of the line
+ * @param   p_address   pointer to the parsed address
+ * @return  1 if a function address has been found, 0 otherwise
  **/
 
-void read_poi_from_file(char *psz_file, poi_t *p_poi_list)
+static int parse_symbol_line(const char *p_line, const char *p_end, uint64_t *p_address)
 {
-    FILE *poi_file;
-    int i, sol, eol, eov, eof = 0;
-    int nb_bytes_read;
-    unsigned char line_buffer[4096];
-    int line_len = 0;
-    uint64_t symbol;
-    int nb_symbols = 0;
-
-    /* Open file. */
-    poi_file = fopen(psz_file, "rb");
-    if (poi_file != NULL)
+    const char *p_field, *p_field_end, *p_type;
+    int i;
+
+    p_line = skip_spaces(p_line, p_end);
+    if (p_line >= p_end)
+        return 0;
+
+    /* Ghidra CSV export. */
+    if (*p_line == '"')
     {
-        /* Parse file content. */
-        line_len = 0;
-        while (line_len >= 0)
-        {
-            eov = -1;
-            eol = -1;
-            sol = -1;
+        /* Skip name, extract location. */
+        p_field = field_end(p_line + 1, p_end, '"');
+        p_field = field_end(p_field, p_end, ',');
+        if ((p_field >= p_end) || (p_field[1] != '"'))
+            return 0;
+        p_field += 2;
+        p_field_end = field_end(p_field, p_end, '"');
 
-            /* Read 4096 bytes from file and fill our line buffer. */
-            if (!feof(poi_file))
-            {
-                nb_bytes_read = fread(&line_buffer[line_len], 1, 4096 - line_len, poi_file);
-                line_len += nb_bytes_read;
-                debug("Read %d bytes from symbols file\n", nb_bytes_read);
-            }
-            else
-                eof = 1;
+        /* Only keep functions. */
+        p_type = field_end(p_field_end, p_end, ',');
+        if (((p_end - p_type) < 11) || strncmp(p_type, ",\"Function\"", 11))
+            return 0;
 
-            /* Line is supposed to start with '0x', if not just chop content until we meet a '0x'. */
-            if ((line_buffer[0] == '0') && (line_buffer[1] == 'x'))
+        /* Remove address space. */
+        for (i=0; (p_field + i) < p_field_end; i++)
+        {
+            if (p_field[i] == ':')
             {
-                //debug("Line starts with '0x', sol=0\n");
-                sol = 0;
-                for (i=0; i<line_len; i++)
-                {
-                    if (line_buffer[i] == '\n')
-                    {
-                        eol = i;
-                        break;
-                    }
-                    if (line_buffer[i] == ' ')
-                    {
-                        eov = i;
-                    }
-                }
-                //debug("Line ends at offset eol=%d\n", eol);
+                p_field += i + 1;
+                break;
             }
-            else
+        }
+
+        return decode_hex(p_field, p_field_end, p_address);
+    }
+
+    /* Original format. */
+    if (((p_end - p_line) > 2) && (p_line[0] == '0') && ((p_line[1] == 'x') || (p_line[1] == 'X')))
+        return decode_hex(p_line + 2, field_end(p_line + 2, p_end, ' '), p_address);
+
+    /* IDA functions window export, start address is the third field. */
+    p_field = field_end(p_line, p_end, '\t');
+    if (p_field < p_end)
+    {
+        p_field = field_end(p_field + 1, p_end, '\t');
+        if (p_field < p_end)
+        {
+            p_field++;
+            if (decode_hex(p_field, field_end(p_field, p_end, '\t'), p_address))
+                return 1;
+        }
+    }
+
+    /* nm output, keep text symbols only. */
+    p_field = field_end(p_line, p_end, ' ');
+    if (decode_hex(p_line, p_field, p_address))
+    {
+        p_type = skip_spaces(p_field, p_end);
+        if (((p_end - p_type) >= 2) && ((p_type[1] == ' ') || (p_type[1] == '\t')))
+        {
+            if ((*p_type == 'T') || (*p_type == 't') || (*p_type == 'W') || (*p_type == 'w'))
+                return 1;
+        }
+    }
+
+    /* Other lines, use the first `0x<address> <name>` pair found as the original parser did. */
+    for (p_field=p_line; (p_end - p_field) > 2; p_field++)
+    {
+        if ((p_field[0] != '0') || (p_field[1] != 'x'))
+            continue;
+
+        for (p_field_end=p_field+2; (p_field_end < p_end) && (g_hex_digits[(uint8_t)*p_field_end] >= 0); p_field_end++);
+        if ((p_field_end < p_end) && ((*p_field_end == ' ') || (*p_field_end == '\t')) &&
+            decode_hex(p_field + 2, p_field_end, p_address))
+            return 1;
+    }
+
+    return 0;
+}
+
+
+/**
+ * @brief   Compare two addresses (qsort callback)
+ **/
+
+static int address_compare(const void *a, const void *b)
+{
+    uint64_t addr_a = *(const uint64_t *)a;
+    uint64_t addr_b = *(const uint64_t *)b;
+
+    if (addr_a < addr_b)
+        return -1;
+    return (addr_a > addr_b);
+}
+
+
+/**
+ * @brief   Load functions addresses from a symbols file
+ *
+ * The file is mapped in memory and parsed line by line, see
+ * parse_symbol_line() for the supported formats. Addresses are sorted and
+ * duplicates removed.
+ *
+ * @param   psz_file        Path to file
+ * @return  pointer to an allocated symbols array, or NULL on error
+ **/
+
+symbols_t *symbols_load(char *psz_file)
+{
+    int fd;
+    struct stat file_stat;
+    const char *p_content = NULL, *p_line, *p_end, *p_eol;
+    symbols_t *p_symbols;
+    uint64_t *p_addresses;
+    uint64_t nb_allocated = 0x1000, i, j;
+    uint64_t address;
+
+    fd = open(psz_file, O_RDONLY);
+    if (fd < 0)
+    {
+        error("Cannot open symbols file %s\n", psz_file);
+        return NULL;
+    }
+
+    if (fstat(fd, &file_stat) < 0)
+    {
+        error("Cannot read symbols file %s\n", psz_file);
+        close(fd);
+        return NULL;
+    }
+
+    /* Map file, it is read once from start to end. */
+    if (file_stat.st_size > 0)
+    {
+        p_content = (const char *)mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p_content == MAP_FAILED)
+        {
+            error("Cannot map symbols file %s\n", psz_file);
+            close(fd);
+            return NULL;
+        }
+        madvise((void *)p_content, file_stat.st_size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+
+    p_symbols = (symbols_t *)malloc(sizeof(symbols_t));
+    if (p_symbols != NULL)
+    {
+        p_symbols->nb_addresses = 0;
+        p_symbols->p_addresses = (uint64_t *)malloc(nb_allocated * sizeof(uint64_t));
+        if (p_symbols->p_addresses == NULL)
+        {
+            free(p_symbols);
+            p_symbols = NULL;
+        }
+    }
+    if (p_symbols == NULL)
+    {
+        error("Cannot allocate memory for symbols.\n");
+        if (p_content != NULL)
+            munmap((void *)p_content, file_stat.st_size);
+        return NULL;
+    }
+
+    /* Parse lines. */
+    p_line = p_content;
+    p_end = p_content + file_stat.st_size;
+    while (p_line < p_end)
+    {
+        p_eol = (const char *)memchr(p_line, '\n', p_end - p_line);
+        if (p_eol == NULL)
+            p_eol = p_end;
+
+        if (parse_symbol_line(p_line, p_eol, &address))
+        {
+            if (p_symbols->nb_addresses == nb_allocated)
             {
-                for (i=0; i<(line_len-1); i++)
+                p_addresses = (uint64_t *)realloc(p_symbols->p_addresses, 2 * nb_allocated * sizeof(uint64_t));
+                if (p_addresses == NULL)
                 {
-                    if ((line_buffer[i] == '0') && (line_buffer[i+1] == 'x'))
-                    {
-                        sol = i;
-                    } else if (sol > 0)
-                    {
-                        if ((line_buffer[i] == ' ') && (eov<0))
-                            eov = i;
-                        else if (line_buffer[i] == '\n')
-                        {
-                            eol = i;
-                            break;
-                        }
-                    }
+                    error("Cannot allocate memory for symbols.\n");
+                    break;
                 }
+                p_symbols->p_addresses = p_addresses;
+                nb_allocated *= 2;
             }
+            p_symbols->p_addresses[p_symbols->nb_addresses++] = address;
+        }
 
+        p_line = p_eol + 1;
+    }
 
-            if ((eol>0) && (sol>=0) && (eov > 1))
-            {
-                /* Found EOL, parse value */
-                line_buffer[eov] = '\0';
-                symbol = strtol((char *)&line_buffer[sol+2], NULL, 16);
-                debug("Loaded symbol 0x%016x\n", symbol);
-                poi_add_unique(p_poi_list, symbol, 1, POI_FUNCTION);
-                nb_symbols++;
-            }
-            
-            /* If no start of line, forget the buffer. */
-            if (sol < 0)
-            {
-                line_len = 0;
-            }
-            else if (eol < 0) /* Got a start of line but still waiting end of line */
-            {
-                /* Reached end of file ? Stop here. */
-                if (eof)
-                    break;
+    if (p_content != NULL)
+        munmap((void *)p_content, file_stat.st_size);
 
-                /* Move start of line to the beginning of the buffer. */
-                for (i=sol; i<line_len; i++)
-                    line_buffer[i-sol] = line_buffer[i];
-                line_len -= sol;
-            }
-            else if (eol >= 0)
-            {
-                /* Move start of line to the beginning of the buffer. */
-                for (i=(eol+1); i<line_len; i++)
-                    line_buffer[i-(eol+1)] = line_buffer[i];
-                line_len -= (eol+1);
-            }
-            if (line_len == 0)
-                break;
+    /* Sort addresses and remove duplicates. */
+    if (p_symbols->nb_addresses > 0)
+    {
+        qsort(p_symbols->p_addresses, p_symbols->nb_addresses, sizeof(uint64_t), address_compare);
+        for (i=1, j=1; i<p_symbols->nb_addresses; i++)
+        {
+            if (p_symbols->p_addresses[i] != p_symbols->p_addresses[j-1])
+                p_symbols->p_addresses[j++] = p_symbols->p_addresses[i];
         }
+        p_symbols->nb_addresses = j;
     }
 
-    fclose(poi_file);
-    debug("Loaded %d symbols !\n", nb_symbols);
-}
\ No newline at end of file
+    return p_symbols;
+}
+
+
+/**
+ * @brief   Free a symbols array
+ * @param   p_symbols   pointer to a symbols array
+ **/
+
+void symbols_free(symbols_t *p_symbols)
+{
+    if (p_symbols != NULL)
+    {
+        free(p_symbols->p_addresses);
+        free(p_symbols);
+    }
+}
+
+
+/**
+ * @brief   Load a list of functions addresses from a file.
+ *
+ * Read a list of point of interest from a file, see symbols_load() for the
+ * supported formats. Functions are added by increasing address.
+ *
+ * @param   psz_file        Path to file
+ * @param   p_poi_list      pointer to a list of POI to fill
+ **/
+
+void read_poi_from_file(char *psz_file, poi_t *p_poi_list)
+{
+    symbols_t *p_symbols;
+    poi_t *p_last;
+    uint64_t i;
+
+    p_symbols = symbols_load(psz_file);
+    if (p_symbols != NULL)
+    {
+        /* Addresses are unique, append them to the end of the list. */
+        p_last = poi_list_get_last_item(p_poi_list);
+        for (i=0; i<p_symbols->nb_addresses; i++)
+        {
+            if (poi_add(p_last, p_symbols->p_addresses[i], 1, POI_FUNCTION) < 0)
+                break;
+            p_last = p_last->p_next;
+        }
+
+        debug("Loaded %ld symbols !\n", i);
+        symbols_free(p_symbols);
+    }
+}
@@ -3,4 +3,12 @@
 #include "poi.h"
 #include "log.h"
 
-void read_poi_from_file(char *psz_file, poi_t *p_poi_list);
\ No newline at end of file
+/* Sorted array of unique functions addresses. */
+typedef struct {
+    uint64_t *p_addresses;
+    uint64_t nb_addresses;
+} symbols_t;
+
+symbols_t *symbols_load(char *psz_file);
+void symbols_free(symbols_t *p_symbols);
+void read_poi_from_file(char *psz_file, poi_t *p_poi_list);
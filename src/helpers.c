@@ -12,40 +12,138 @@ pthread_mutex_t io_lock = PTHREAD_MUTEX_INITIALIZER;
 
 int is_ascii_ptr(uint64_t u64_address, arch_t arch)
 {
-    int i;
+    return is_ascii_ptr_sized(u64_address, get_arch_pointer_size(arch));
+}
+
+
+/**
+ * @brief   Find printable bytes of a word
+ *
+ * With the high bit of each byte cleared, adding 0x60 (resp. 0x01) to a byte
+ * sets its high bit if it is at least 0x20 (resp. 0x7f), without any carry to
+ * the next byte.
+ *
+ * @param   word    8 bytes
+ * @return  word with the high bit of each printable byte set, other bits cleared
+ **/
+
+static inline uint64_t printable_bytes(uint64_t word)
+{
+    uint64_t low = word & 0x7f7f7f7f7f7f7f7fULL;
+
+    return (low + 0x6060606060606060ULL) & ~(low + 0x0101010101010101ULL) & ~word & 0x8080808080808080ULL;
+}
+
+
+/**
+ * @brief   Find the next printable (or non-printable) character
+ *
+ * Characters are checked 8 at a time (see printable_bytes()), only a word
+ * holding the searched class is then checked byte per byte.
+ *
+ * @param   p_data      pointer to data
+ * @param   start       offset of the first character to check
+ * @param   end         offset following the last character to check
+ * @param   printable   1 to find a printable character, 0 to find a non-printable one
+ * @return  offset of the first character found, or `end` if none
+ **/
+
+uint64_t find_printable(unsigned char *p_data, uint64_t start, uint64_t end, int printable)
+{
+    uint64_t word, printables;
 
-    if (arch == ARCH_32)
+    while ((start + sizeof(uint64_t)) <= end)
     {
-        for (i=0;i<4;i++)
-        {
-            if ( ((u64_address&0xff) < 0x20) || ((u64_address&0xff) > 0x7f))
-                return 0;
-            u64_address = u64_address>>8;
-        }
+        memcpy(&word, &p_data[start], sizeof(uint64_t));
+        printables = printable_bytes(word);
+        if (printables != (printable?0:0x8080808080808080ULL))
+            break;
+        start += sizeof(uint64_t);
     }
-    else
+
+    while ((start < end) && (is_printable(p_data[start]) != printable))
+        start++;
+
+    return start;
+}
+
+
+/**
+ * @brief   Find the next printable (or non-printable) UTF-16 character
+ *
+ * Code units are checked 4 at a time, as in find_printable(): a unit is a
+ * printable character if its low byte is printable and its high byte is null.
+ * Words are read in host order, as read_pointer() does for little-endian
+ * pointers.
+ *
+ * @param   p_data      pointer to data
+ * @param   start       offset of the first code unit to check
+ * @param   end         offset following the last byte to check
+ * @param   printable   1 to find a printable character, 0 to find a non-printable one
+ * @param   big_endian  1 for UTF-16BE, 0 for UTF-16LE
+ * @return  offset of the first code unit found (`start` plus a multiple of 2), or
+ *          the offset of the first code unit not fitting before `end` if none
+ **/
+
+uint64_t find_wide_printable(unsigned char *p_data, uint64_t start, uint64_t end, int printable, int big_endian)
+{
+    uint64_t word, printables, nulls, units;
+
+    while ((start + sizeof(uint64_t)) <= end)
     {
-        for (i=0;i<8;i++)
-        {
-            if ( ((u64_address&0xff) < 0x20) || ((u64_address&0xff) > 0x7f))
-                return 0;
-            u64_address = u64_address>>8;
-        }
+        memcpy(&word, &p_data[start], sizeof(uint64_t));
+        printables = printable_bytes(word);
+        nulls = ~(((word & 0x7f7f7f7f7f7f7f7fULL) + 0x7f7f7f7f7f7f7f7fULL) | word) & 0x8080808080808080ULL;
+        if (big_endian)
+            units = nulls & (printables >> 8) & 0x0080008000800080ULL;
+        else
+            units = printables & (nulls >> 8) & 0x0080008000800080ULL;
+        if (units != (printable?0:0x0080008000800080ULL))
+            break;
+        start += sizeof(uint64_t);
     }
 
-    return 1;
+    while (((start + 2) <= end) && (is_wide_printable(&p_data[start], big_endian) != printable))
+        start += 2;
+
+    return start;
 }
 
 
 /**
- * @brief   Get pointer size depending on the architecture (32 or 64 bit)
+ * @brief   Get pointer size depending on the architecture (16, 24, 32 or 64 bit)
  * @param   arch    target architecture
  * @return  size of pointer
  **/
 
 int get_arch_pointer_size(arch_t arch)
 {
-    return (arch==ARCH_32)?4:8;
+    switch (arch)
+    {
+        case ARCH_16:
+            return 2;
+
+        case ARCH_24:
+            return 3;
+
+        case ARCH_64:
+            return 8;
+
+        default:
+            return 4;
+    }
+}
+
+
+/**
+ * @brief   Get the mask of valid pointer bits depending on the architecture
+ * @param   arch    target architecture
+ * @return  highest possible pointer value
+ **/
+
+uint64_t get_arch_pointer_mask(arch_t arch)
+{
+    return (arch==ARCH_64)?0xffffffffffffffff:((1ULL << (get_arch_pointer_size(arch)*8)) - 1);
 }
 
 
@@ -57,33 +155,9 @@ int get_arch_pointer_size(arch_t arch)
  * @param   offset      offset to read
  **/
 
-uint64_t read_pointer(arch_t arch, endianness_t endian, unsigned char *p_content, unsigned int offset)
+uint64_t read_pointer(arch_t arch, endianness_t endian, unsigned char *p_content, uint64_t offset)
 {
-    uint64_t v;
-
-    /* Read pointer from content. */
-    if (arch == ARCH_32)
-    {
-        v = (uint64_t)(*(uint32_t *)&p_content[offset]);
-    }
-    else
-    {
-        v = (uint64_t)(*(uint64_t *)&p_content[offset]);
-    }
-
-    if (endian == ENDIAN_BE)
-    {
-        if (arch == ARCH_32)
-        {
-            v = (uint64_t)(BSWAP32((uint32_t)v));
-        }
-        else
-        {
-            v = BSWAP64(v);
-        }
-    }
-
-    return v;
+    return read_pointer_sized(p_content, offset, get_arch_pointer_size(arch), (endian == ENDIAN_BE));
 }
 
 
@@ -95,9 +169,10 @@ uint64_t read_pointer(arch_t arch, endianness_t endian, unsigned char *p_content
  * @return  number of different values seen
  **/
 
-int makehist(unsigned char *S, unsigned int *hist,int len){
+int makehist(unsigned char *S, uint64_t *hist, uint64_t len){
 	int wherechar[256];
-	int i,histlen;
+	int histlen;
+	uint64_t i;
 	histlen=0;
 	for(i=0;i<256;i++)wherechar[i]=-1;
 	for(i=0;i<len;i++){
@@ -116,11 +191,12 @@ int makehist(unsigned char *S, unsigned int *hist,int len){
  * @param   size        data size
  **/
 
-double entropy(unsigned char *p_data, int size)
+double entropy(unsigned char *p_data, uint64_t size)
 {
 	int i, histlen;
+	uint64_t j;
 	double H;
-    unsigned int history[256];
+    uint64_t history[256];
     int lookup[256];
     unsigned char c;
 
@@ -133,9 +209,9 @@ double entropy(unsigned char *p_data, int size)
 
     /* Parse data. */
     histlen = 0;
-    for (i=0; i<size; i++)
+    for (j=0; j<size; j++)
     {
-        c = p_data[i];
+        c = p_data[j];
         if (lookup[c] < 0)
         {
             lookup[c] = histlen++;
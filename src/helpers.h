@@ -35,6 +35,7 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
 #include <sys/ioctl.h>
 #include <unistd.h>
@@ -90,11 +91,134 @@
 #pragma warning "Byteswap missing !"
 #endif
 
+/**
+ * @brief   Read a pointer of a given size and endianness
+ *
+ * Meant to be called with constant `size` and `big_endian`, so that it is
+ * inlined as a single load (and byte swap) without any branch.
+ *
+ * @param   p_content   pointer to firmware content
+ * @param   offset      offset to read
+ * @param   size        pointer size in bytes (2, 3, 4 or 8)
+ * @param   big_endian  1 if pointer is big-endian, 0 otherwise
+ * @return  pointer value
+ **/
+
+static inline uint64_t read_pointer_sized(unsigned char *p_content, uint64_t offset, int size, int big_endian)
+{
+    uint32_t v32;
+    uint64_t v64;
+
+    switch (size)
+    {
+        case 2:
+            if (big_endian)
+                return ((uint64_t)p_content[offset] << 8) | p_content[offset + 1];
+            else
+                return ((uint64_t)p_content[offset + 1] << 8) | p_content[offset];
+
+        case 3:
+            if (big_endian)
+                return ((uint64_t)p_content[offset] << 16) | ((uint64_t)p_content[offset + 1] << 8) | p_content[offset + 2];
+            else
+                return ((uint64_t)p_content[offset + 2] << 16) | ((uint64_t)p_content[offset + 1] << 8) | p_content[offset];
+
+        case 4:
+            memcpy(&v32, &p_content[offset], sizeof(uint32_t));
+            return big_endian?(uint64_t)BSWAP32(v32):(uint64_t)v32;
+
+        default:
+            memcpy(&v64, &p_content[offset], sizeof(uint64_t));
+            return big_endian?BSWAP64(v64):v64;
+    }
+}
+
+
+/**
+ * @brief   Check if a pointer of a given size is made of ASCII characters
+ *
+ * All bytes are tested at once: a byte is below 0x20 if subtracting 0x20
+ * sets its high bit while it was clear, and above 0x7f if its high bit is set.
+ *
+ * @param   u64_address     address
+ * @param   size            pointer size in bytes (2, 3, 4 or 8)
+ * @return  1 if address contains only ASCII, 0 otherwise
+ **/
+
+static inline int is_ascii_ptr_sized(uint64_t u64_address, int size)
+{
+    uint64_t mask = 0xffffffffffffffffULL >> (64 - size*8);
+    uint64_t low = 0x2020202020202020ULL & mask;
+    uint64_t high = 0x8080808080808080ULL & mask;
+
+    return ((((u64_address - low) & ~u64_address) | u64_address) & high) == 0;
+}
+
+
+/**
+ * @brief   Check if a character is printable, as isprint() does in the C locale
+ * @param   c   character
+ * @return  1 if character is printable (0x20-0x7e), 0 otherwise
+ **/
+
+static inline int is_printable(unsigned char c)
+{
+    return (c >= 0x20) && (c < 0x7f);
+}
+
+
+/**
+ * @brief   Check if a UTF-16 code unit is a printable character
+ * @param   p_unit      pointer to the code unit
+ * @param   big_endian  1 for UTF-16BE, 0 for UTF-16LE
+ * @return  1 if code unit is printable (0x0020-0x007e), 0 otherwise
+ **/
+
+static inline int is_wide_printable(unsigned char *p_unit, int big_endian)
+{
+    return big_endian?((p_unit[0] == 0) && is_printable(p_unit[1])):(is_printable(p_unit[0]) && (p_unit[1] == 0));
+}
+
+
+/**
+ * @brief   Find the next byte having some bits set
+ *
+ * Bytes are checked 8 at a time, then one by one in the first word having a
+ * matching byte.
+ *
+ * @param   p_data  pointer to bytes
+ * @param   start   index of the first byte to check
+ * @param   end     index following the last byte to check
+ * @param   mask    bits to check (at least one of them must be set)
+ * @return  index of the first matching byte, or `end` if none
+ **/
+
+static inline uint64_t find_byte_mask(uint8_t *p_data, uint64_t start, uint64_t end, uint8_t mask)
+{
+    uint64_t word;
+
+    while ((start + sizeof(uint64_t)) <= end)
+    {
+        memcpy(&word, &p_data[start], sizeof(uint64_t));
+        if (word & (0x0101010101010101ULL * mask))
+            break;
+        start += sizeof(uint64_t);
+    }
+
+    while ((start < end) && !(p_data[start] & mask))
+        start++;
+
+    return start;
+}
+
 /* Exposed functions. */
 int is_ascii_ptr(uint64_t address, arch_t arch);
+uint64_t find_printable(unsigned char *p_data, uint64_t start, uint64_t end, int printable);
+uint64_t find_wide_printable(unsigned char *p_data, uint64_t start, uint64_t end, int printable, int big_endian);
 int get_arch_pointer_size(arch_t arch);
-uint64_t read_pointer(arch_t arch, endianness_t endian, unsigned char *p_content, unsigned int offset);
-double entropy(unsigned char *p_data, int size);
+uint64_t get_arch_pointer_mask(arch_t arch);
+uint64_t read_pointer(arch_t arch, endianness_t endian, unsigned char *p_content, uint64_t offset);
+double entropy(unsigned char *p_data, uint64_t size);
 
 void progress_bar(uint64_t current, uint64_t max, char *desc);
 void progress_bar_done(void);
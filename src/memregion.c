@@ -2,6 +2,10 @@
 
 memregion_t *g_regions = NULL;
 
+/* Region map: type of each block of MEMORY_REGION_MIN_SIZE bytes. */
+uint8_t *g_region_map = NULL;
+uint64_t g_region_map_size = 0;
+
 /**
  * Create memory region
  **/
@@ -34,6 +38,69 @@ void memregion_free_all(void)
         free(p_item);
         p_item = p_next_item;
     }
+    g_regions = NULL;
+
+    memregion_free_map();
+}
+
+/**
+ * Free region map, memory_get_type() then walks the regions list.
+ **/
+
+void memregion_free_map(void)
+{
+    if (g_region_map != NULL)
+    {
+        free(g_region_map);
+        g_region_map = NULL;
+        g_region_map_size = 0;
+    }
+}
+
+/**
+ * Build region map, for constant time lookups in memory_get_type().
+ *
+ * Regions must be aligned on MEMORY_REGION_MIN_SIZE, as found by
+ * memory_analyze(). Returns 0 on success, -1 otherwise.
+ **/
+
+int memregion_build_map(void)
+{
+    memregion_t *p_region;
+    uint64_t nb_blocks = 0, i;
+
+    memregion_free_map();
+
+    /* Check regions alignment, compute map size. */
+    p_region = memregion_enum_first();
+    while (p_region != NULL)
+    {
+        if (((p_region->offset % MEMORY_REGION_MIN_SIZE) != 0) || ((p_region->size % MEMORY_REGION_MIN_SIZE) != 0))
+            return -1;
+        if (nb_blocks < ((p_region->offset + p_region->size) / MEMORY_REGION_MIN_SIZE))
+            nb_blocks = (p_region->offset + p_region->size) / MEMORY_REGION_MIN_SIZE;
+
+        p_region = memregion_enum_next(p_region);
+    }
+
+    g_region_map = (uint8_t *)malloc(nb_blocks + 1);
+    if (g_region_map == NULL)
+        return -1;
+    memset(g_region_map, REGION_UNKNOWN, nb_blocks + 1);
+
+    /* Regions do not overlap, fill their blocks. */
+    p_region = memregion_enum_first();
+    while (p_region != NULL)
+    {
+        for (i=p_region->offset/MEMORY_REGION_MIN_SIZE; i<(p_region->offset + p_region->size)/MEMORY_REGION_MIN_SIZE; i++)
+            g_region_map[i] = p_region->type;
+
+        p_region = memregion_enum_next(p_region);
+    }
+    g_region_map_size = nb_blocks;
+
+    /* Success. */
+    return 0;
 }
 
 /**
@@ -48,6 +115,9 @@ int memregion_add(uint64_t offset, uint64_t size, double entropy, memregion_type
     p_region = memregion_create(offset, size, entropy, type);
     if (p_region != NULL)
     {
+        /* Region map is outdated. */
+        memregion_free_map();
+
         if (g_regions != NULL)
             p_region->p_next = g_regions;
         g_regions = p_region;
@@ -88,14 +158,14 @@ memregion_t *memregion_enum_next(memregion_t *p_item)
  *  - classify regions (code, initialized data, uninitialized data) based on architecture
  **/
 
-void memory_analyze(void *p_data, int size, char *arch)
+void memory_analyze(void *p_data, uint64_t size, char *arch)
 {
-    int nsections, i;
+    uint64_t nsections, i;
     double ent;
     arch_info_t *p_arch;
     memregion_type_t prev_region_type = REGION_UNKNOWN;
-    unsigned int region_start = 0;
-    unsigned int region_size;
+    uint64_t region_start = 0;
+    uint64_t region_size = 0;
 
     p_arch = arch_get_info(arch);
 
@@ -214,6 +284,9 @@ void memory_analyze(void *p_data, int size, char *arch)
             /* Register previous region. */
             memregion_add(region_start, region_size, ent, prev_region_type);
         }
+
+        /* Regions are aligned on MEMORY_REGION_MIN_SIZE, map them. */
+        memregion_build_map();
     }
 }
 
@@ -221,6 +294,14 @@ memregion_type_t memory_get_type(uint64_t offset)
 {
     memregion_t *p_region;
 
+    /* Constant time lookup if regions are mapped. */
+    if (g_region_map != NULL)
+    {
+        if ((offset / MEMORY_REGION_MIN_SIZE) < g_region_map_size)
+            return (memregion_type_t)g_region_map[offset / MEMORY_REGION_MIN_SIZE];
+        return REGION_UNKNOWN;
+    }
+
     p_region = memregion_enum_first();
     while(p_region != NULL)
     {
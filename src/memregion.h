@@ -42,9 +42,13 @@ void memregion_free_all(void);
 /* Add region. */
 int memregion_add(uint64_t offset, uint64_t size, double entropy, memregion_type_t type);
 
+/* Region map, for constant time memory_get_type(). */
+int memregion_build_map(void);
+void memregion_free_map(void);
+
 /* Enumeration. */
 memregion_t *memregion_enum_first(void);
 memregion_t *memregion_enum_next(memregion_t *p_item);
 
-void memory_analyze(void *p_data, int size, char *arch);
+void memory_analyze(void *p_data, uint64_t size, char *arch);
 memregion_type_t memory_get_type(uint64_t offset);
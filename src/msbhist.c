@@ -0,0 +1,455 @@
+#include "msbhist.h"
+#include "helpers.h"
+
+/* Number of values decoded at once by msbhist_scan(). */
+#define MSBHIST_BATCH_SIZE  256
+
+
+/**
+ * @brief   Allocate an MSB histogram
+ * @param   width   width of values in bits (16, 24, 32 or 64)
+ * @param   shift   number of least significant bits to ignore
+ * @return  pointer to newly allocated MSB histogram, or NULL on error
+ **/
+
+msbhist_t *msbhist_alloc(unsigned int width, unsigned int shift)
+{
+    msbhist_t *p_hist;
+
+    p_hist = (msbhist_t *)calloc(1, sizeof(msbhist_t));
+    if (p_hist != NULL)
+    {
+        p_hist->width = width;
+        p_hist->shift = shift;
+        p_hist->nb_keys = ((width - shift) >= 64)?0xffffffffffffffff:(1ULL << (width - shift));
+
+        if (p_hist->nb_keys <= MSBHIST_FLAT_SIZE)
+        {
+            /* Every key is a low key. */
+            p_hist->nb_low = p_hist->nb_keys;
+            p_hist->nb_high = 0;
+            p_hist->high_start = p_hist->nb_keys;
+        }
+        else
+        {
+            p_hist->nb_low = MSBHIST_FLAT_SIZE;
+            p_hist->nb_high = MSBHIST_FLAT_SIZE;
+            p_hist->high_start = p_hist->nb_keys - MSBHIST_FLAT_SIZE;
+        }
+
+        p_hist->p_low = (uint64_t *)calloc(p_hist->nb_low + 1, sizeof(uint64_t));
+        p_hist->p_high = (uint64_t *)calloc(p_hist->nb_high + 1, sizeof(uint64_t));
+        p_hist->p_sparse_keys = (uint64_t *)calloc(MSBHIST_SPARSE_SIZE, sizeof(uint64_t));
+        p_hist->p_sparse_counts = (uint64_t *)calloc(MSBHIST_SPARSE_SIZE, sizeof(uint64_t));
+        p_hist->p_sparse_slots = (uint64_t *)malloc((MSBHIST_SPARSE_SIZE/2 + 1) * sizeof(uint64_t));
+        p_hist->sparse_mask = MSBHIST_SPARSE_SIZE - 1;
+        if ((p_hist->p_low == NULL) || (p_hist->p_high == NULL) ||
+            (p_hist->p_sparse_keys == NULL) || (p_hist->p_sparse_counts == NULL) || (p_hist->p_sparse_slots == NULL))
+        {
+            msbhist_free(p_hist);
+            return NULL;
+        }
+    }
+
+    return p_hist;
+}
+
+
+/**
+ * @brief   Free an MSB histogram
+ * @param   p_hist  pointer to the MSB histogram to free
+ **/
+
+void msbhist_free(msbhist_t *p_hist)
+{
+    if (p_hist != NULL)
+    {
+        free(p_hist->p_low);
+        free(p_hist->p_high);
+        free(p_hist->p_sparse_keys);
+        free(p_hist->p_sparse_counts);
+        free(p_hist->p_sparse_slots);
+        free(p_hist);
+    }
+}
+
+
+/**
+ * @brief   Find the slot of a key in a sparse keys hash table
+ * @param   p_keys      pointer to the hash table keys
+ * @param   mask        hash table mask (number of slots - 1)
+ * @param   key         key to find
+ * @return  slot of the key, or empty slot where it should be inserted
+ **/
+
+static uint64_t msbhist_sparse_slot(uint64_t *p_keys, uint64_t mask, uint64_t key)
+{
+    uint64_t slot;
+
+    slot = ((key * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
+    while ((p_keys[slot] != 0) && (p_keys[slot] != (key + 1)))
+        slot = (slot + 1) & mask;
+
+    return slot;
+}
+
+
+/**
+ * @brief   Rebuild the sparse keys hash table, keeping keys above a threshold
+ * @param   p_hist      pointer to an MSB histogram
+ * @param   nb_slots    number of slots of the new hash table (power of 2)
+ * @param   threshold   minimum count of keys to keep
+ * @return  0 on success, -1 on error (hash table is left unchanged)
+ **/
+
+static int msbhist_sparse_rebuild(msbhist_t *p_hist, uint64_t nb_slots, uint64_t threshold)
+{
+    uint64_t *p_keys;
+    uint64_t *p_counts;
+    uint64_t *p_slots;
+    uint64_t i, old_slot, slot, nb_sparse = 0, sparse_max = 0;
+
+    p_keys = (uint64_t *)calloc(nb_slots, sizeof(uint64_t));
+    p_counts = (uint64_t *)calloc(nb_slots, sizeof(uint64_t));
+    p_slots = (uint64_t *)malloc((nb_slots/2 + 1) * sizeof(uint64_t));
+    if ((p_keys == NULL) || (p_counts == NULL) || (p_slots == NULL))
+    {
+        free(p_keys);
+        free(p_counts);
+        free(p_slots);
+        return -1;
+    }
+
+    for (i=0; i<p_hist->nb_sparse; i++)
+    {
+        old_slot = p_hist->p_sparse_slots[i];
+        if (p_hist->p_sparse_counts[old_slot] >= threshold)
+        {
+            slot = msbhist_sparse_slot(p_keys, nb_slots - 1, p_hist->p_sparse_keys[old_slot] - 1);
+            p_keys[slot] = p_hist->p_sparse_keys[old_slot];
+            p_counts[slot] = p_hist->p_sparse_counts[old_slot];
+            if (p_counts[slot] > sparse_max)
+                sparse_max = p_counts[slot];
+            p_slots[nb_sparse++] = slot;
+        }
+    }
+
+    free(p_hist->p_sparse_keys);
+    free(p_hist->p_sparse_counts);
+    free(p_hist->p_sparse_slots);
+    p_hist->p_sparse_keys = p_keys;
+    p_hist->p_sparse_counts = p_counts;
+    p_hist->p_sparse_slots = p_slots;
+    p_hist->sparse_mask = nb_slots - 1;
+    p_hist->nb_sparse = nb_sparse;
+    p_hist->sparse_max = sparse_max;
+
+    return 0;
+}
+
+
+/**
+ * @brief   Add a count to a key of the sparse keys hash table
+ * @param   p_hist  pointer to an MSB histogram
+ * @param   key     key to count
+ * @param   count   count to add to this key
+ **/
+
+static void msbhist_sparse_add(msbhist_t *p_hist, uint64_t key, uint64_t count)
+{
+    uint64_t slot;
+
+    /* Keep the hash table at most half full. */
+    if ((2*(p_hist->nb_sparse + 1)) > (p_hist->sparse_mask + 1))
+        msbhist_sparse_rebuild(p_hist, 2*(p_hist->sparse_mask + 1), 0);
+
+    slot = msbhist_sparse_slot(p_hist->p_sparse_keys, p_hist->sparse_mask, key);
+    if (p_hist->p_sparse_keys[slot] == 0)
+    {
+        p_hist->p_sparse_keys[slot] = key + 1;
+        p_hist->p_sparse_slots[p_hist->nb_sparse++] = slot;
+    }
+
+    p_hist->p_sparse_counts[slot] += count;
+    if (p_hist->p_sparse_counts[slot] > p_hist->sparse_max)
+        p_hist->sparse_max = p_hist->p_sparse_counts[slot];
+}
+
+
+/**
+ * @brief   Clear all counters of an MSB histogram
+ *
+ * Only the used slots of the sparse keys hash table are cleared, and the hash
+ * table is shrunk back to its initial size.
+ *
+ * @param   p_hist  pointer to an MSB histogram
+ **/
+
+void msbhist_reset(msbhist_t *p_hist)
+{
+    uint64_t i, slot;
+
+    memset(p_hist->p_low, 0, (p_hist->nb_low + 1) * sizeof(uint64_t));
+    memset(p_hist->p_high, 0, (p_hist->nb_high + 1) * sizeof(uint64_t));
+    for (i=0; i<p_hist->nb_sparse; i++)
+    {
+        slot = p_hist->p_sparse_slots[i];
+        p_hist->p_sparse_keys[slot] = 0;
+        p_hist->p_sparse_counts[slot] = 0;
+    }
+    p_hist->nb_sparse = 0;
+    p_hist->sparse_max = 0;
+    p_hist->sparse_kept = 0;
+
+    if (p_hist->sparse_mask >= MSBHIST_SPARSE_SIZE)
+        msbhist_sparse_rebuild(p_hist, MSBHIST_SPARSE_SIZE, 0);
+}
+
+
+/**
+ * @brief   Register a key that is neither a low nor a high key
+ * @param   p_hist  pointer to an MSB histogram
+ * @param   key     key to register
+ **/
+
+void msbhist_register_sparse(msbhist_t *p_hist, uint64_t key)
+{
+    msbhist_sparse_add(p_hist, key, 1);
+}
+
+
+/**
+ * @brief   Add the counters of an MSB histogram to another one (same width and shift)
+ *
+ * Sparse keys missing from the destination histogram are skipped if counted less
+ * than `threshold`, so that a merge followed by a filtering with a threshold at
+ * least as high does not insert keys only to forget them.
+ *
+ * @param   p_dst       pointer to the destination MSB histogram
+ * @param   p_src       pointer to the MSB histogram to add
+ * @param   threshold   minimum count of new sparse keys to add (0 or 1 to add them all)
+ **/
+
+void msbhist_merge(msbhist_t *p_dst, msbhist_t *p_src, uint64_t threshold)
+{
+    uint64_t i, slot, key;
+
+    for (i=0; i<=p_dst->nb_low; i++)
+        p_dst->p_low[i] += p_src->p_low[i];
+    for (i=0; i<p_dst->nb_high; i++)
+        p_dst->p_high[i] += p_src->p_high[i];
+
+    for (i=0; i<p_src->nb_sparse; i++)
+    {
+        slot = p_src->p_sparse_slots[i];
+        key = p_src->p_sparse_keys[slot] - 1;
+        if ((p_src->p_sparse_counts[slot] < threshold) &&
+            (p_dst->p_sparse_keys[msbhist_sparse_slot(p_dst->p_sparse_keys, p_dst->sparse_mask, key)] == 0))
+            continue;
+        msbhist_sparse_add(p_dst, key, p_src->p_sparse_counts[slot]);
+    }
+}
+
+
+/**
+ * @brief   Register the values found at every offset of a memory area, as LE and BE
+ *
+ * Values are decoded by batches: a first loop loads each value, byte-swaps it
+ * and computes its key (or 0 if the value is null or not 4-byte aligned) without
+ * any branch, then keys are registered in both histograms. 16-bit and 24-bit
+ * values are assembled byte per byte and only need to be non-null, as pointers
+ * of such architectures are seldom aligned.
+ *
+ * @param   p_hist_le   pointer to the MSB histogram of LE values
+ * @param   p_hist_be   pointer to the MSB histogram of BE values
+ * @param   p_data      pointer to data
+ * @param   start       offset of the first value to register
+ * @param   end         offset following the last value to register
+ **/
+
+void msbhist_scan(msbhist_t *p_hist_le, msbhist_t *p_hist_be, uint8_t *p_data, uint64_t start, uint64_t end)
+{
+    uint64_t index_le[MSBHIST_BATCH_SIZE];
+    uint64_t index_be[MSBHIST_BATCH_SIZE];
+    uint64_t cursor, le, be;
+    uint32_t v32;
+    uint64_t v64;
+    unsigned int shift = p_hist_le->shift;
+    int j, count;
+
+    for (cursor=start; cursor<end; cursor+=count)
+    {
+        count = ((end - cursor) < MSBHIST_BATCH_SIZE)?(int)(end - cursor):MSBHIST_BATCH_SIZE;
+
+        /* Decode values. */
+        if (p_hist_le->width == 16)
+        {
+            for (j=0; j<count; j++)
+            {
+                le = p_data[cursor + j] | ((uint64_t)p_data[cursor + j + 1] << 8);
+                be = p_data[cursor + j + 1] | ((uint64_t)p_data[cursor + j] << 8);
+                index_le[j] = (le != 0)?((le >> shift) + 1):0;
+                index_be[j] = (be != 0)?((be >> shift) + 1):0;
+            }
+        }
+        else if (p_hist_le->width == 24)
+        {
+            for (j=0; j<count; j++)
+            {
+                le = p_data[cursor + j] | ((uint64_t)p_data[cursor + j + 1] << 8) | ((uint64_t)p_data[cursor + j + 2] << 16);
+                be = p_data[cursor + j + 2] | ((uint64_t)p_data[cursor + j + 1] << 8) | ((uint64_t)p_data[cursor + j] << 16);
+                index_le[j] = (le != 0)?((le >> shift) + 1):0;
+                index_be[j] = (be != 0)?((be >> shift) + 1):0;
+            }
+        }
+        else if (p_hist_le->width == 32)
+        {
+            for (j=0; j<count; j++)
+            {
+                memcpy(&v32, &p_data[cursor + j], sizeof(uint32_t));
+                le = v32;
+                be = BSWAP32(v32);
+                index_le[j] = ((le != 0) && ((le & 3) == 0))?((le >> shift) + 1):0;
+                index_be[j] = ((be != 0) && ((be & 3) == 0))?((be >> shift) + 1):0;
+            }
+        }
+        else
+        {
+            for (j=0; j<count; j++)
+            {
+                memcpy(&v64, &p_data[cursor + j], sizeof(uint64_t));
+                le = v64;
+                be = BSWAP64(v64);
+                index_le[j] = ((le != 0) && ((le & 3) == 0))?((le >> shift) + 1):0;
+                index_be[j] = ((be != 0) && ((be & 3) == 0))?((be >> shift) + 1):0;
+            }
+        }
+
+        /* Count them. */
+        for (j=0; j<count; j++)
+        {
+            msbhist_register_index(p_hist_le, index_le[j]);
+            msbhist_register_index(p_hist_be, index_be[j]);
+        }
+    }
+}
+
+
+/**
+ * @brief   Get the highest count of an MSB histogram
+ *
+ * Only the flat arrays are scanned, the highest count of the sparse keys is
+ * kept up to date as they are counted.
+ *
+ * @param   p_hist  pointer to an MSB histogram
+ * @return  highest count
+ **/
+
+uint64_t msbhist_max(msbhist_t *p_hist)
+{
+    uint64_t max_votes = p_hist->sparse_max;
+    uint64_t i;
+
+    for (i=1; i<=p_hist->nb_low; i++)
+        max_votes = (p_hist->p_low[i] > max_votes)?p_hist->p_low[i]:max_votes;
+    for (i=0; i<p_hist->nb_high; i++)
+        max_votes = (p_hist->p_high[i] > max_votes)?p_hist->p_high[i]:max_votes;
+
+    return max_votes;
+}
+
+
+/**
+ * @brief   Forget keys counted less than a given threshold (as addrtree_filter() does)
+ *
+ * Every counted key is kept with a threshold of 1 or less, and nothing is done.
+ * Otherwise the sparse keys hash table is rebuilt from the kept keys only, and
+ * may shrink.
+ *
+ * @param   p_hist      pointer to an MSB histogram
+ * @param   threshold   minimum count of keys to keep
+ **/
+
+void msbhist_filter(msbhist_t *p_hist, uint64_t threshold)
+{
+    uint64_t i, nb_kept, nb_new, nb_slots;
+
+    if (threshold <= 1)
+        return;
+
+    for (i=1; i<=p_hist->nb_low; i++)
+        p_hist->p_low[i] = (p_hist->p_low[i] < threshold)?0:p_hist->p_low[i];
+    for (i=0; i<p_hist->nb_high; i++)
+        p_hist->p_high[i] = (p_hist->p_high[i] < threshold)?0:p_hist->p_high[i];
+
+    if (p_hist->nb_sparse > 0)
+    {
+        /*
+         * Size the new hash table for the kept keys and as many new keys as
+         * since the last filtering, so that it can shrink without growing
+         * again right away.
+         */
+        nb_kept = 0;
+        for (i=0; i<p_hist->nb_sparse; i++)
+            nb_kept += (p_hist->p_sparse_counts[p_hist->p_sparse_slots[i]] >= threshold);
+        nb_new = (p_hist->nb_sparse > p_hist->sparse_kept)?(p_hist->nb_sparse - p_hist->sparse_kept):0;
+        for (nb_slots=MSBHIST_SPARSE_SIZE; nb_slots<(2*(nb_kept + nb_new + 1)); nb_slots*=2);
+
+        if (msbhist_sparse_rebuild(p_hist, nb_slots, threshold) == 0)
+            p_hist->sparse_kept = nb_kept;
+    }
+}
+
+
+/**
+ * @brief   Get the smallest key having the highest count
+ * @param   p_hist      pointer to an MSB histogram
+ * @param   p_votes     pointer to the highest count (output, optional)
+ * @return  smallest key having the highest count
+ **/
+
+uint64_t msbhist_first_max(msbhist_t *p_hist, uint64_t *p_votes)
+{
+    uint64_t max_votes = msbhist_max(p_hist);
+    uint64_t i, slot, key = 0;
+    int found = 0;
+
+    /* Low keys are smaller than sparse keys, which are smaller than high keys. */
+    for (i=1; (i<=p_hist->nb_low) && !found; i++)
+    {
+        if (p_hist->p_low[i] == max_votes)
+        {
+            key = i - 1;
+            found = 1;
+        }
+    }
+
+    if (!found)
+    {
+        /* Sparse keys are not sorted, keep the smallest one. */
+        for (i=0; i<p_hist->nb_sparse; i++)
+        {
+            slot = p_hist->p_sparse_slots[i];
+            if ((p_hist->p_sparse_counts[slot] == max_votes) &&
+                (!found || ((p_hist->p_sparse_keys[slot] - 1) < key)))
+            {
+                key = p_hist->p_sparse_keys[slot] - 1;
+                found = 1;
+            }
+        }
+    }
+
+    for (i=0; (i<p_hist->nb_high) && !found; i++)
+    {
+        if (p_hist->p_high[i] == max_votes)
+        {
+            key = p_hist->high_start + i;
+            found = 1;
+        }
+    }
+
+    if (p_votes != NULL)
+        *p_votes = max_votes;
+
+    return key;
+}
@@ -0,0 +1,99 @@
+/**
+ * MSB histogram
+ *
+ * Endianness detection only needs to count how many times each set of most
+ * significant bits (MSB) of a pointer-sized value appears in a firmware. An
+ * MSB histogram counts values by key (value >> shift) in flat arrays rather
+ * than in a memory address tree:
+ *
+ * - keys close to 0 (low keys) are counted in a flat array of up to 64K counters,
+ * - keys close to the maximum key (high keys) in another flat array of 64K counters,
+ * - any other key in a small open-addressing hash table.
+ *
+ * With 32-bit values and firmware files of 128KB or more, every key is a low
+ * key and registering a value costs a single increment.
+ **/
+
+#pragma once
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+/* Maximum number of counters of the low and high keys arrays. */
+#define MSBHIST_FLAT_SIZE   0x10000
+
+/* Initial number of slots of the sparse keys hash table. */
+#define MSBHIST_SPARSE_SIZE 0x400
+
+typedef struct {
+    /* Width of values (in bits) and number of bits ignored. */
+    unsigned int width;
+    unsigned int shift;
+
+    /* Number of possible keys. */
+    uint64_t nb_keys;
+
+    /* Low keys counters (with a discard counter at index 0, key k at k+1). */
+    uint64_t *p_low;
+    uint64_t nb_low;
+
+    /* High keys counters (key k at k - high_start). */
+    uint64_t *p_high;
+    uint64_t nb_high;
+    uint64_t high_start;
+
+    /* Sparse keys (stored as key+1, 0 means empty slot). */
+    uint64_t *p_sparse_keys;
+    uint64_t *p_sparse_counts;
+    uint64_t sparse_mask;
+    uint64_t nb_sparse;
+
+    /* Used slots of the sparse keys hash table (`nb_sparse` items). */
+    uint64_t *p_sparse_slots;
+
+    /* Highest count of the sparse keys, kept up to date as keys are counted. */
+    uint64_t sparse_max;
+
+    /* Number of sparse keys kept by the last filtering. */
+    uint64_t sparse_kept;
+} msbhist_t;
+
+msbhist_t *msbhist_alloc(unsigned int width, unsigned int shift);
+void msbhist_free(msbhist_t *p_hist);
+void msbhist_reset(msbhist_t *p_hist);
+void msbhist_merge(msbhist_t *p_dst, msbhist_t *p_src, uint64_t threshold);
+void msbhist_register_sparse(msbhist_t *p_hist, uint64_t key);
+void msbhist_scan(msbhist_t *p_hist_le, msbhist_t *p_hist_be, uint8_t *p_data, uint64_t start, uint64_t end);
+uint64_t msbhist_max(msbhist_t *p_hist);
+void msbhist_filter(msbhist_t *p_hist, uint64_t threshold);
+uint64_t msbhist_first_max(msbhist_t *p_hist, uint64_t *p_votes);
+
+
+/**
+ * @brief   Register a key, given as key+1 (0 is discarded)
+ * @param   p_hist  pointer to an MSB histogram
+ * @param   index   key+1, or 0 to discard
+ **/
+
+static inline void msbhist_register_index(msbhist_t *p_hist, uint64_t index)
+{
+    if (index <= p_hist->nb_low)
+        p_hist->p_low[index]++;
+    else if ((index - 1) >= p_hist->high_start)
+        p_hist->p_high[index - 1 - p_hist->high_start]++;
+    else
+        msbhist_register_sparse(p_hist, index - 1);
+}
+
+
+/**
+ * @brief   Register a value
+ * @param   p_hist  pointer to an MSB histogram
+ * @param   value   value to register
+ **/
+
+static inline void msbhist_register(msbhist_t *p_hist, uint64_t value)
+{
+    msbhist_register_index(p_hist, (value >> p_hist->shift) + 1);
+}
@@ -107,7 +107,7 @@ void poi_list_append(poi_t *p_poi_list, poi_t *poi)
  * @return  0 on success, -1 otherwise
  **/
 
-int poi_add_structure_array(poi_t *p_poi_list, uint64_t offset, int count, int nb_members, int *signature)
+int poi_add_structure_array(poi_t *p_poi_list, uint64_t offset, int64_t count, int nb_members, int *signature)
 {
     poi_t *poi;
     int *p_signature;
@@ -169,7 +169,7 @@ int poi_add_structure_array(poi_t *p_poi_list, uint64_t offset, int count, int n
  * @return  0 on success, -1 otherwise
  **/
 
-int poi_add(poi_t *p_poi_list, uint64_t offset, int count, poi_type_t type)
+int poi_add(poi_t *p_poi_list, uint64_t offset, int64_t count, poi_type_t type)
 {
     poi_t *poi;
 
@@ -207,7 +207,7 @@ int poi_add(poi_t *p_poi_list, uint64_t offset, int count, poi_type_t type)
  * @return  0 on success, -1 otherwise
  **/
 
-int poi_add_unique(poi_t *p_poi_list, uint64_t offset, int count, poi_type_t type)
+int poi_add_unique(poi_t *p_poi_list, uint64_t offset, int64_t count, poi_type_t type)
 {
     poi_t *poi;
 
@@ -257,7 +257,7 @@ int poi_add_unique(poi_t *p_poi_list, uint64_t offset, int count, poi_type_t typ
 int is_in_poi(poi_t *p_poi_list, arch_t arch, uint64_t address, uint64_t offset)
 {
     poi_t *p_poi;
-    int arch_size = (arch == ARCH_32)?4:8;
+    int arch_size = get_arch_pointer_size(arch);
 
     p_poi = p_poi_list->p_next;
     while (p_poi != NULL)
@@ -265,6 +265,7 @@ int is_in_poi(poi_t *p_poi_list, arch_t arch, uint64_t address, uint64_t offset)
         switch (p_poi->type)
         {
             case POI_STRING:
+            case POI_WSTRING:
                 {
                     if (address == (p_poi->offset + offset))
                     {
@@ -377,9 +378,9 @@ int poi_add_unique_sorted(poi_t *p_poi_list, poi_t *p_poi)
  * @param   p_poi_list  pointer to a list of POI
  * @return  number of POI
  **/
-unsigned int poi_count(poi_t *p_poi_list)
+uint64_t poi_count(poi_t *p_poi_list)
 {
-    unsigned int count = 0;
+    uint64_t count = 0;
     poi_t *poi;
 
     /* Does this offset already belong to a poi ?*/
@@ -391,4 +392,167 @@ unsigned int poi_count(poi_t *p_poi_list)
     }
 
     return count;
-}
\ No newline at end of file
+}
+
+
+/**
+ * @brief   Compute hash slot of an offset in a POI index
+ * @param   p_index     pointer to a POI index
+ * @param   offset      offset to hash
+ * @return  slot index
+ **/
+
+static uint64_t poi_index_slot(poi_index_t *p_index, uint64_t offset)
+{
+    /* Fibonacci hashing, keep the most mixed bits. */
+    return ((offset * 0x9E3779B97F4A7C15ULL) >> 32) & p_index->mask;
+}
+
+
+/**
+ * @brief   Insert a POI in a POI index, unless its offset is already indexed
+ * @param   p_index     pointer to a POI index
+ * @param   poi         pointer to the POI to insert
+ **/
+
+static void poi_index_insert(poi_index_t *p_index, poi_t *poi)
+{
+    uint64_t slot;
+
+    /* Linear probing, stop on the first free slot or same offset. */
+    slot = poi_index_slot(p_index, poi->offset);
+    while ((p_index->pp_items[slot] != NULL) && (p_index->pp_items[slot]->offset != poi->offset))
+        slot = (slot + 1) & p_index->mask;
+    if (p_index->pp_items[slot] == NULL)
+    {
+        p_index->pp_items[slot] = poi;
+        p_index->nb_items++;
+    }
+}
+
+
+/**
+ * @brief   Create a hash index of a list of POI, keyed by offset
+ *
+ * When multiple POIs share the same offset, the first one in list order is
+ * returned by poi_index_lookup(), as a walk through the list would do.
+ *
+ * @param   p_poi_list  pointer to a list of POI
+ * @return  pointer to an allocated POI index, or NULL on error
+ **/
+
+poi_index_t *poi_index_create(poi_t *p_poi_list)
+{
+    poi_index_t *p_index;
+    poi_t *poi;
+    uint64_t nb_slots;
+
+    p_index = (poi_index_t *)malloc(sizeof(poi_index_t));
+    if (p_index != NULL)
+    {
+        /* Keep the table at most half full. */
+        nb_slots = 16;
+        while (nb_slots < 2*(uint64_t)poi_count(p_poi_list))
+            nb_slots *= 2;
+
+        p_index->mask = nb_slots - 1;
+        p_index->nb_items = 0;
+        p_index->pp_items = (poi_t **)calloc(nb_slots, sizeof(poi_t *));
+        if (p_index->pp_items == NULL)
+        {
+            free(p_index);
+            return NULL;
+        }
+
+        poi = p_poi_list->p_next;
+        while (poi != NULL)
+        {
+            poi_index_insert(p_index, poi);
+            poi = poi->p_next;
+        }
+    }
+
+    return p_index;
+}
+
+
+/**
+ * @brief   Add a POI to a POI index, growing the index if needed
+ *
+ * The POI is ignored if its offset is already indexed.
+ *
+ * @param   p_index     pointer to a POI index
+ * @param   poi         pointer to the POI to add
+ * @return  0 on success, -1 otherwise
+ **/
+
+int poi_index_add(poi_index_t *p_index, poi_t *poi)
+{
+    poi_t **pp_items;
+    uint64_t nb_slots, i;
+
+    /* Keep the table at most half full. */
+    nb_slots = p_index->mask + 1;
+    if (2*(p_index->nb_items + 1) > nb_slots)
+    {
+        pp_items = p_index->pp_items;
+        p_index->pp_items = (poi_t **)calloc(2*nb_slots, sizeof(poi_t *));
+        if (p_index->pp_items == NULL)
+        {
+            p_index->pp_items = pp_items;
+            return -1;
+        }
+
+        /* Rehash indexed POIs. */
+        p_index->mask = 2*nb_slots - 1;
+        p_index->nb_items = 0;
+        for (i=0; i<nb_slots; i++)
+        {
+            if (pp_items[i] != NULL)
+                poi_index_insert(p_index, pp_items[i]);
+        }
+        free(pp_items);
+    }
+
+    poi_index_insert(p_index, poi);
+
+    return 0;
+}
+
+
+/**
+ * @brief   Find a POI by offset in a POI index
+ * @param   p_index     pointer to a POI index
+ * @param   offset      offset to look for
+ * @return  pointer to the POI located at `offset`, or NULL if not found
+ **/
+
+poi_t *poi_index_lookup(poi_index_t *p_index, uint64_t offset)
+{
+    uint64_t slot;
+
+    slot = poi_index_slot(p_index, offset);
+    while (p_index->pp_items[slot] != NULL)
+    {
+        if (p_index->pp_items[slot]->offset == offset)
+            return p_index->pp_items[slot];
+        slot = (slot + 1) & p_index->mask;
+    }
+
+    return NULL;
+}
+
+
+/**
+ * @brief   Free a POI index (indexed POIs are not freed)
+ * @param   p_index     pointer to a POI index
+ **/
+
+void poi_index_free(poi_index_t *p_index)
+{
+    if (p_index != NULL)
+    {
+        free(p_index->pp_items);
+        free(p_index);
+    }
+}
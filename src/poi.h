@@ -7,6 +7,7 @@
 typedef enum {
     POI_UNKNOWN,
     POI_STRING,
+    POI_WSTRING,
     POI_ARRAY,
     POI_STRUCTURE,
     POI_FUNCTION,
@@ -18,6 +19,7 @@ typedef enum {
     POI_FUNCTION_POINTER,
     POI_ARRAY_POINTER,
     POI_STRING_POINTER,
+    POI_WSTRING_POINTER,
     POI_POINTER_POINTER,
     POI_STRUCTURE_POINTER,
     POI_STRUCT_ARRAY_POINTER,
@@ -35,7 +37,7 @@ typedef struct _poi_t {
     uint64_t offset;
 
     /* Size. */
-    int count;
+    int64_t count;
 
     /* Used for structures. */
     int *signature;
@@ -46,14 +48,25 @@ typedef struct _poi_t {
 
 } poi_t;
 
+/* Hash index of a list of POI, keyed by offset. */
+typedef struct {
+    poi_t **pp_items;
+    uint64_t mask;
+    uint64_t nb_items;
+} poi_index_t;
+
 void poi_init(poi_t *p_poi_list);
 poi_t *poi_list(void);
 void poi_list_free(poi_t *p_poi_list);
 void poi_list_append(poi_t *p_poi_list, poi_t *poi);
 poi_t *poi_list_get_last_item(poi_t *p_poi_list);
-int poi_add(poi_t *p_poi_list, uint64_t offset, int count, poi_type_t type);
-int poi_add_unique(poi_t *p_poi_list, uint64_t offset, int count, poi_type_t type);
+int poi_add(poi_t *p_poi_list, uint64_t offset, int64_t count, poi_type_t type);
+int poi_add_unique(poi_t *p_poi_list, uint64_t offset, int64_t count, poi_type_t type);
 int poi_add_unique_sorted(poi_t *p_poi_list, poi_t *p_poi);
-int poi_add_structure_array(poi_t *p_poi_list, uint64_t offset, int count, int nb_members, int *signature);
+int poi_add_structure_array(poi_t *p_poi_list, uint64_t offset, int64_t count, int nb_members, int *signature);
 int is_in_poi(poi_t *p_poi_list, arch_t arch, uint64_t address, uint64_t offset);
-unsigned int poi_count(poi_t *p_poi_list);
+uint64_t poi_count(poi_t *p_poi_list);
+poi_index_t *poi_index_create(poi_t *p_poi_list);
+int poi_index_add(poi_index_t *p_index, poi_t *poi);
+poi_t *poi_index_lookup(poi_index_t *p_index, uint64_t offset);
+void poi_index_free(poi_index_t *p_index);
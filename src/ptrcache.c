@@ -0,0 +1,116 @@
+#include "ptrcache.h"
+#include "helpers.h"
+
+/**
+ * @brief   Allocate a pointers cache for a given firmware size
+ *
+ * Values are filled by the `build_ptrcache` scan kernel matching the target
+ * architecture and endianness (see scan_kernels.h).
+ *
+ * @param   arch            target architecture
+ * @param   content_size    firmware size in bytes
+ * @return  pointer to newly allocated pointers cache, or NULL on error
+ **/
+
+ptrcache_t *ptrcache_alloc(arch_t arch, uint64_t content_size)
+{
+    ptrcache_t *p_cache;
+
+    p_cache = (ptrcache_t *)calloc(1, sizeof(ptrcache_t));
+    if (p_cache != NULL)
+    {
+        p_cache->ptr_size = get_arch_pointer_size(arch);
+        p_cache->value_size = (p_cache->ptr_size == 3)?4:p_cache->ptr_size;
+        p_cache->nb_values = (content_size + p_cache->ptr_size - 1) / p_cache->ptr_size;
+        p_cache->p_values = malloc(p_cache->nb_values * p_cache->value_size + 1);
+        p_cache->p_flags = (uint8_t *)malloc(p_cache->nb_values + 1);
+        if ((p_cache->p_values == NULL) || (p_cache->p_flags == NULL))
+        {
+            ptrcache_free(p_cache);
+            return NULL;
+        }
+    }
+
+    return p_cache;
+}
+
+
+/**
+ * @brief   Free a pointers cache
+ * @param   p_cache     pointer to the pointers cache to free
+ **/
+
+void ptrcache_free(ptrcache_t *p_cache)
+{
+    if (p_cache != NULL)
+    {
+        free(p_cache->p_values);
+        free(p_cache->p_flags);
+        free(p_cache);
+    }
+}
+
+
+/**
+ * @brief   Allocate an empty pointers index
+ *
+ * Indexes are filled by the `build_ptrindex` scan kernel (see scan_kernels.h).
+ *
+ * @param   align_mask  mask of the lowest bits of pointers (memory alignment - 1)
+ * @return  pointer to newly allocated pointers index, or NULL on error
+ **/
+
+ptrindex_t *ptrindex_alloc(uint64_t align_mask)
+{
+    ptrindex_t *p_index;
+
+    p_index = (ptrindex_t *)calloc(1, sizeof(ptrindex_t));
+    if (p_index != NULL)
+    {
+        /* Values matching on the alignment mask also match on its lowest bits. */
+        p_index->bucket_mask = align_mask & (PTRINDEX_MAX_BUCKETS - 1);
+        p_index->p_starts = (uint64_t *)calloc(p_index->bucket_mask + 2, sizeof(uint64_t));
+        if (p_index->p_starts == NULL)
+        {
+            free(p_index);
+            return NULL;
+        }
+    }
+
+    return p_index;
+}
+
+
+/**
+ * @brief   Allocate the indexes of a pointers index
+ * @param   p_index     pointer to a pointers index
+ * @param   nb_indexes  number of indexes
+ * @param   nb_values   number of values of the indexed pointers cache
+ * @return  0 on success, -1 on error
+ **/
+
+int ptrindex_reserve(ptrindex_t *p_index, uint64_t nb_indexes, uint64_t nb_values)
+{
+    free(p_index->p_indexes);
+    p_index->nb_indexes = nb_indexes;
+    p_index->index_size = (nb_values > 0x100000000ULL)?sizeof(uint64_t):sizeof(uint32_t);
+    p_index->p_indexes = malloc(nb_indexes * p_index->index_size + 1);
+
+    return (p_index->p_indexes == NULL)?-1:0;
+}
+
+
+/**
+ * @brief   Free a pointers index
+ * @param   p_index     pointer to the pointers index to free
+ **/
+
+void ptrindex_free(ptrindex_t *p_index)
+{
+    if (p_index != NULL)
+    {
+        free(p_index->p_starts);
+        free(p_index->p_indexes);
+        free(p_index);
+    }
+}
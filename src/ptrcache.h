@@ -0,0 +1,90 @@
+/**
+ * Decoded pointers cache
+ *
+ * Most analysis phases read the value found at every pointer-aligned offset of
+ * the firmware, some of them once per point of interest or once per candidate
+ * base address. A pointers cache decodes these values once (in the target
+ * endianness) into a column of values of the pointer size, along with a few
+ * flags telling whether each value looks like a pointer.
+ *
+ * Value `i` is the pointer read at offset `i * ptr_size`. A last incomplete
+ * value (if the firmware size is not a multiple of the pointer size) is padded
+ * with null bytes.
+ *
+ * A pointers index lists the values having some flags, grouped by their lowest
+ * bits: voting for base addresses only needs the values whose lowest bits match
+ * the ones of a given PoI, and finds them in a single bucket. Indexes are
+ * stored on 32 bits unless the cache holds more than 2^32 values.
+ **/
+
+#pragma once
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "common.h"
+
+/* Value is not made of ASCII characters. */
+#define PTRCACHE_NOT_ASCII  0x01
+
+/* Value is a multiple of the pointer size. */
+#define PTRCACHE_ALIGNED    0x02
+
+/* Value is neither null nor the highest possible pointer. */
+#define PTRCACHE_NOT_NULL   0x04
+
+/* Maximum number of buckets of a pointers index. */
+#define PTRINDEX_MAX_BUCKETS    0x10000
+
+typedef struct {
+    /* Pointer size in bytes, and size of each value in the column. */
+    unsigned int ptr_size;
+    unsigned int value_size;
+
+    /* Decoded values and their flags. */
+    uint64_t nb_values;
+    void *p_values;
+    uint8_t *p_flags;
+} ptrcache_t;
+
+typedef struct {
+    /* Lowest bits of the values used to select a bucket. */
+    uint64_t bucket_mask;
+
+    /* Bucket `b` spans from p_indexes[p_starts[b]] to p_indexes[p_starts[b+1]] (excluded). */
+    uint64_t *p_starts;
+
+    /* Indexes of the listed values in the pointers cache, in ascending order in each bucket. */
+    uint64_t nb_indexes;
+    unsigned int index_size;
+    void *p_indexes;
+} ptrindex_t;
+
+ptrcache_t *ptrcache_alloc(arch_t arch, uint64_t content_size);
+void ptrcache_free(ptrcache_t *p_cache);
+ptrindex_t *ptrindex_alloc(uint64_t align_mask);
+int ptrindex_reserve(ptrindex_t *p_index, uint64_t nb_indexes, uint64_t nb_values);
+void ptrindex_free(ptrindex_t *p_index);
+
+
+/**
+ * @brief   Get a decoded value
+ * @param   p_cache     pointer to a pointers cache
+ * @param   index       value index (offset / pointer size)
+ * @return  decoded value
+ **/
+
+static inline uint64_t ptrcache_get(ptrcache_t *p_cache, uint64_t index)
+{
+    switch (p_cache->value_size)
+    {
+        case 2:
+            return ((uint16_t *)p_cache->p_values)[index];
+
+        case 4:
+            return ((uint32_t *)p_cache->p_values)[index];
+
+        default:
+            return ((uint64_t *)p_cache->p_values)[index];
+    }
+}
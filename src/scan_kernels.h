@@ -0,0 +1,394 @@
+/**
+ * Specialized scan kernels
+ *
+ * This header is a template, included by binbloom.c once per pointer width and
+ * endianness after defining:
+ *
+ * - KERNEL_SUFFIX: suffix of the generated functions (e.g. _32le),
+ * - KERNEL_PTR_SIZE: pointer size in bytes (2, 3, 4 or 8),
+ * - KERNEL_BIG_ENDIAN: 1 for big-endian pointers, 0 otherwise.
+ *
+ * Pointers are decoded once into the pointers cache `gp_ptrcache` by the
+ * `build_ptrcache` kernel, with read_pointer_sized() inlined with a constant size
+ * and endianness. Other kernels then scan this column of values (of the pointer
+ * type) and its flags, so that the hot loops do not decode nor branch on the
+ * target architecture or endianness anymore. Kernels are exposed through a
+ * `scan_kernels_t` structure named `g_scan_kernels` followed by KERNEL_SUFFIX,
+ * and the macros above are undefined at the end of this file.
+ **/
+
+#ifndef KERNEL_NAME
+#define KERNEL_CAT_(a, b)   a##b
+#define KERNEL_CAT(a, b)    KERNEL_CAT_(a, b)
+#define KERNEL_NAME(name)   KERNEL_CAT(name, KERNEL_SUFFIX)
+#endif
+
+/* Type of the values of the pointers cache. */
+#if KERNEL_PTR_SIZE == 2
+#define KERNEL_PTR_TYPE     uint16_t
+#elif KERNEL_PTR_SIZE == 8
+#define KERNEL_PTR_TYPE     uint64_t
+#else
+#define KERNEL_PTR_TYPE     uint32_t
+#endif
+
+/* Highest possible pointer value. */
+#define KERNEL_PTR_MASK     (0xffffffffffffffffULL >> (64 - KERNEL_PTR_SIZE*8))
+
+/* Get the decoded value found at a given offset (multiple of the pointer size). */
+#define KERNEL_VALUES       ((KERNEL_PTR_TYPE *)gp_ptrcache->p_values)
+
+/*
+ * Check that two values are close enough to belong to the same array. As in
+ * the original abs() test, the distance is computed on the lower 32 bits of
+ * their difference, and a difference of 0x80000000 (whose absolute value
+ * overflows) is considered close.
+ */
+#define KERNEL_IS_CLOSE(a, b)   (((uint32_t)((uint32_t)((a) - (b)) + 0x1000) <= 0x2000) \
+                                 | ((uint32_t)((a) - (b)) == 0x80000000))
+
+
+/**
+ * @brief   Decode the values of the pointers cache and compute their flags
+ *
+ * Both loops are free of branches, so that the compiler can vectorize them
+ * (byte swaps included).
+ *
+ * @param   p_cache     pointer to a pointers cache allocated for the firmware
+ **/
+
+static void KERNEL_NAME(build_ptrcache)(ptrcache_t *p_cache)
+{
+    KERNEL_PTR_TYPE *p_values = (KERNEL_PTR_TYPE *)p_cache->p_values;
+    uint8_t *p_flags = p_cache->p_flags;
+    unsigned char last[8];
+    uint64_t i, nb_full;
+    uint64_t v;
+
+    /* Decode complete values. */
+    nb_full = g_content_size / KERNEL_PTR_SIZE;
+    for (i=0; i<nb_full; i++)
+        p_values[i] = (KERNEL_PTR_TYPE)read_pointer_sized(gp_content, i*KERNEL_PTR_SIZE, KERNEL_PTR_SIZE, KERNEL_BIG_ENDIAN);
+
+    /* Pad the last incomplete value with null bytes. */
+    if (nb_full < p_cache->nb_values)
+    {
+        memset(last, 0, sizeof(last));
+        memcpy(last, &gp_content[nb_full*KERNEL_PTR_SIZE], g_content_size - nb_full*KERNEL_PTR_SIZE);
+        p_values[nb_full] = (KERNEL_PTR_TYPE)read_pointer_sized(last, 0, KERNEL_PTR_SIZE, KERNEL_BIG_ENDIAN);
+    }
+
+    /* Compute flags. */
+    for (i=0; i<p_cache->nb_values; i++)
+    {
+        v = p_values[i];
+        p_flags[i] = (is_ascii_ptr_sized(v, KERNEL_PTR_SIZE)?0:PTRCACHE_NOT_ASCII) |
+                     (((v % KERNEL_PTR_SIZE) == 0)?PTRCACHE_ALIGNED:0) |
+                     (((v != 0) && (v != KERNEL_PTR_MASK))?PTRCACHE_NOT_NULL:0);
+    }
+}
+
+
+/**
+ * @brief   List the values of the pointers cache having some flags, grouped by their lowest bits
+ *
+ * Values are counted per bucket then listed, both passes only read the pointers
+ * cache sequentially.
+ *
+ * @param   p_index     pointer to an empty pointers index
+ * @param   required    flags values must have
+ * @return  0 on success, -1 on error
+ **/
+
+static int KERNEL_NAME(build_ptrindex)(ptrindex_t *p_index, uint8_t required)
+{
+    KERNEL_PTR_TYPE *p_values = KERNEL_VALUES;
+    uint8_t *p_flags = gp_ptrcache->p_flags;
+    uint64_t *p_starts = p_index->p_starts;
+    uint64_t bucket_mask = p_index->bucket_mask;
+    uint64_t i, bucket;
+
+    /* Count selected values of each bucket (bucket b is counted in p_starts[b+1]). */
+    for (i=0; i<gp_ptrcache->nb_values; i++)
+        p_starts[(p_values[i] & bucket_mask) + 1] += ((p_flags[i] & required) == required);
+
+    /* Compute the start of each bucket. */
+    for (bucket=1; bucket<=bucket_mask+1; bucket++)
+        p_starts[bucket] += p_starts[bucket - 1];
+
+    if (ptrindex_reserve(p_index, p_starts[bucket_mask + 1], gp_ptrcache->nb_values) < 0)
+        return -1;
+
+    /* List values, p_starts[b] ends up at the start of bucket b+1. */
+    if (p_index->index_size == sizeof(uint32_t))
+    {
+        for (i=0; i<gp_ptrcache->nb_values; i++)
+        {
+            if ((p_flags[i] & required) == required)
+                ((uint32_t *)p_index->p_indexes)[p_starts[p_values[i] & bucket_mask]++] = (uint32_t)i;
+        }
+    }
+    else
+    {
+        for (i=0; i<gp_ptrcache->nb_values; i++)
+        {
+            if ((p_flags[i] & required) == required)
+                ((uint64_t *)p_index->p_indexes)[p_starts[p_values[i] & bucket_mask]++] = i;
+        }
+    }
+
+    /* Restore the start of each bucket. */
+    for (bucket=bucket_mask+1; bucket>0; bucket--)
+        p_starts[bucket] = p_starts[bucket - 1];
+    p_starts[0] = 0;
+
+    return 0;
+}
+
+
+/**
+ * @brief   Find a value from which arrays can be searched independently, see index_poi_arrays()
+ *
+ * A null value that is not close to the previous one ends any array and does
+ * not start a new one, so that array search is in the same state after this
+ * value whatever the previous values.
+ *
+ * @param   index       index of the first value to check (at least 1)
+ * @param   nb_values   index of the first value not to check
+ * @return  index of the found value, or `nb_values` if none
+ **/
+
+static uint64_t KERNEL_NAME(find_arrays_sync)(uint64_t index, uint64_t nb_values)
+{
+    KERNEL_PTR_TYPE *p_values = KERNEL_VALUES;
+    uint8_t *p_flags = gp_ptrcache->p_flags;
+
+    for (; index<nb_values; index++)
+    {
+        if (!(p_flags[index] & PTRCACHE_NOT_NULL) && !KERNEL_IS_CLOSE(p_values[index], p_values[index - 1]))
+            break;
+    }
+
+    return index;
+}
+
+
+/**
+ * @brief   Find arrays of similar values in a range of values, see index_poi_arrays()
+ *
+ * An array starts at a value that is neither null nor the highest pointer, and
+ * goes on while values are close to the previous one. Values are processed by
+ * blocks: values that are not close to the previous one are marked first (in
+ * a loop the compiler can vectorize), then arrays are delimited by skipping
+ * 8 marks or flags at a time.
+ *
+ * @param   params  pointer to an `arrays_params_t` structure, arrays are appended to `params->arrays`
+ **/
+
+static void KERNEL_NAME(index_poi_arrays)(arrays_params_t *params)
+{
+    KERNEL_PTR_TYPE *p_values = KERNEL_VALUES;
+    uint8_t *p_flags = gp_ptrcache->p_flags;
+    uint8_t breaks[ARRAYS_BLOCK_SIZE];
+    uint64_t block, block_end, ary_start_index = 0;
+    uint64_t i, j, count;
+    int is_in_ary = 0;
+
+    for (block=params->start; block<params->end; block=block_end)
+    {
+        block_end = ((block + ARRAYS_BLOCK_SIZE) < params->end)?(block + ARRAYS_BLOCK_SIZE):params->end;
+
+        /* Mark values that are not close to the previous one (the first value never is in an array). */
+        j = block;
+        if (j == 0)
+            breaks[j++] = 1;
+        for (; j<block_end; j++)
+            breaks[j - block] = !KERNEL_IS_CLOSE(p_values[j], p_values[j - 1]);
+
+        i = block;
+        while (i < block_end)
+        {
+            if (!is_in_ary)
+            {
+                /* Skip to the next non-null value. */
+                i = find_byte_mask(p_flags, i, block_end, PTRCACHE_NOT_NULL);
+                if (i < block_end)
+                {
+                    ary_start_index = i;
+                    is_in_ary = 1;
+                    i++;
+                }
+            }
+            else
+            {
+                /* Skip to the end of the array. */
+                i = block + find_byte_mask(breaks, i - block, block_end - block, 1);
+                if (i < block_end)
+                {
+                    is_in_ary = 0;
+                    count = i - ary_start_index - 1;
+                    if (count > 8)
+                    {
+                        /* Add POI. */
+                        if (poi_add(params->p_last, ary_start_index*KERNEL_PTR_SIZE, count, POI_ARRAY) == 0)
+                            params->p_last = params->p_last->p_next;
+                    }
+                    i++;
+                }
+            }
+        }
+
+        arrays_progress(block_end - block);
+    }
+}
+
+
+/**
+ * @brief   Find potential pointers in file content, see index_poi_pointers()
+ * @param   p_poi_list          pointer to a list of points of interests
+ * @param   u64_base_address    firmware base address to consider
+ **/
+
+static void KERNEL_NAME(index_poi_pointers)(poi_t *p_poi_list, uint64_t u64_base_address)
+{
+    uint64_t cursor=0;
+    uint64_t value;
+    memregion_type_t mem_type;
+    poi_t *poi, *p_last;
+
+    /* New pointers are appended to the end of the list. */
+    p_last = poi_list_get_last_item(p_poi_list);
+
+    while (cursor < g_content_size-KERNEL_PTR_SIZE)
+    {
+        /* Read value as pointer. */
+        value = KERNEL_VALUES[cursor/KERNEL_PTR_SIZE];
+
+        /* If a list of symbols have been provided, use it. */
+        if ((g_symbols_list != NULL) && (memory_get_type(cursor) != REGION_CODE))
+        {
+            /* Check if this pointer points to an existing function. */
+            poi = poi_index_lookup(gp_symbols_index, value - u64_base_address);
+            if ((poi != NULL) && (poi->type == POI_FUNCTION))
+            {
+                if (poi_add(p_last, cursor, 1, POI_FUNCTION_POINTER) == 0)
+                    p_last = p_last->p_next;
+                debug("pointer %016lx points to a known function\n", value);
+            }
+        }
+        else if (memory_get_type(cursor) != REGION_CODE)
+        {
+            /* Is this a valid pointer ? */
+            mem_type = memory_get_type(value - u64_base_address);
+            if (
+                (value >= u64_base_address) &&
+                (value < (u64_base_address + g_content_size)) &&
+                (value!=0) &&
+                (mem_type!=REGION_UNKNOWN) &&
+                (mem_type!=REGION_UNINIT_DATA)
+            )
+            {
+                /* If a pointer points into a code section, set it as a function pointer. */
+                if (mem_type == REGION_CODE)
+                {
+                    /* Add this value as a generic pointer to our PoIs (we don't know yet what it points to). */
+                    if (poi_add(p_last, cursor, 1, POI_FUNCTION_POINTER) == 0)
+                        p_last = p_last->p_next;
+                    debug("pointer %016lx points to code, considering a function pointer\n", value);
+                }
+                else
+                {
+                    /* Add this value as a generic pointer to our PoIs (we don't know yet what it points to). */
+                    if (poi_add(p_last, cursor, 1, POI_GENERIC_POINTER) == 0)
+                        p_last = p_last->p_next;
+                    debug("pointer %016lx points to initialized data, considering a generic pointer\n", value);
+                }
+            }
+        }
+
+        cursor += KERNEL_PTR_SIZE;
+    }
+}
+
+
+/**
+ * @brief   Vote for the base address making a pointer point to a PoI, see register_candidates()
+ * @param   v               candidate pointer
+ * @param   poi_offset      offset of the point of interest
+ * @param   poi_bits        lowest bits of the PoI offset (memory alignment)
+ * @param   p_candidates    pointer to an address tree of candidates
+ * @param   p_votes         pointer to an address array of candidates (used instead of the tree if not NULL)
+ **/
+
+static inline void KERNEL_NAME(register_candidate)(uint64_t v, uint64_t poi_offset, uint64_t poi_bits, addrtree_node_t *p_candidates, addrarray_t *p_votes)
+{
+    uint64_t delta, freespace;
+
+    /* Candidate pointer must match PoI alignment. */
+    if (((v & g_mem_alignment_mask) == poi_bits) && (v >= poi_offset))
+    {
+        delta = (v - poi_offset);
+        freespace = (KERNEL_PTR_MASK - delta) + 1;
+
+        /* Banked firmwares may be larger than the address space. */
+        if (p_votes != NULL)
+        {
+            if ((freespace >= g_content_size) || (g_content_size > KERNEL_PTR_MASK))
+                addrarray_register_address(p_votes, delta);
+        }
+        else if (freespace >= g_content_size)
+        {
+            /* register candidate. */
+            addrtree_register_address(p_candidates, delta);
+        }
+    }
+}
+
+
+/**
+ * @brief   Vote for the base addresses making pointers point to a PoI, see compute_candidates()
+ * @param   p_index         pointer to an index of the candidate pointers (see build_ptrindex())
+ * @param   poi             pointer to a point of interest
+ * @param   p_candidates    pointer to an address tree of candidates
+ * @param   p_votes         pointer to an address array of candidates (used instead of the tree if not NULL)
+ **/
+
+static void KERNEL_NAME(register_candidates)(ptrindex_t *p_index, poi_t *poi, addrtree_node_t *p_candidates, addrarray_t *p_votes)
+{
+    KERNEL_PTR_TYPE *p_values = KERNEL_VALUES;
+    uint64_t i, end;
+    uint64_t poi_offset = poi->offset;
+    uint64_t poi_bits = poi_offset & g_mem_alignment_mask;
+    uint64_t bucket = poi_offset & p_index->bucket_mask;
+
+    /* Candidate pointers are not made of ASCII and aligned if required, and may match PoI alignment. */
+    end = p_index->p_starts[bucket + 1];
+    if (p_index->index_size == sizeof(uint32_t))
+    {
+        for (i=p_index->p_starts[bucket]; i<end; i++)
+            KERNEL_NAME(register_candidate)(p_values[((uint32_t *)p_index->p_indexes)[i]], poi_offset, poi_bits, p_candidates, p_votes);
+    }
+    else
+    {
+        for (i=p_index->p_starts[bucket]; i<end; i++)
+            KERNEL_NAME(register_candidate)(p_values[((uint64_t *)p_index->p_indexes)[i]], poi_offset, poi_bits, p_candidates, p_votes);
+    }
+}
+
+
+static const scan_kernels_t KERNEL_NAME(g_scan_kernels) = {
+    KERNEL_NAME(build_ptrcache),
+    KERNEL_NAME(build_ptrindex),
+    KERNEL_NAME(find_arrays_sync),
+    KERNEL_NAME(index_poi_arrays),
+    KERNEL_NAME(index_poi_pointers),
+    KERNEL_NAME(register_candidates)
+};
+
+#undef KERNEL_IS_CLOSE
+#undef KERNEL_VALUES
+#undef KERNEL_PTR_MASK
+#undef KERNEL_PTR_TYPE
+#undef KERNEL_SUFFIX
+#undef KERNEL_PTR_SIZE
+#undef KERNEL_BIG_ENDIAN